@@ -1,6 +1,6 @@
 QT += gui widgets
 
-CONFIG += c++1z console
+CONFIG += c++2a console
 CONFIG -= app_bundle
 
 # The following define makes your compiler emit warnings if you use
@@ -14,10 +14,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Only the physics demo needs Qt, the tests and benchmarks in test/ and bench/ are plain C++
 SOURCES += \
-        job_system.cpp \
-        job_worker.cpp \
-        test/main.cpp \
+        test/physics_demo_main.cpp \
         test/simple_physics_demo.cpp
 
 # Default rules for deployment.
@@ -26,9 +25,9 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 HEADERS += \
-    job_system.h \
-    job_worker.h \
     mjob.hpp \
+    mjob_coro.hpp \
+    test/physics_world.h \
     test/simple_physics_demo.h \
     test/timing.h \
     test/vector.h
@@ -0,0 +1,150 @@
+#ifndef MJOB_BENCH_HPP
+#define MJOB_BENCH_HPP
+
+#include "mjob.hpp"
+
+//For std::sort
+#include <algorithm>
+//For std::steady_clock
+#include <chrono>
+//For std::printf
+#include <cstdio>
+//For std::strncmp and std::strtoul
+#include <cstring>
+#include <cstdlib>
+//For std::string
+#include <string>
+//For std::vector
+#include <vector>
+
+/**
+ * Command line options shared by every benchmark
+ */
+struct BenchOptions
+{
+    //Untimed repetitions before measuring, warms caches, allocators and queue buffers
+    std::size_t warmups = 3;
+    std::size_t repetitions = 30;
+    //Thread counts are swept in powers of two up to this, plus this itself
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    //Only run benchmarks whose name contains this
+    std::string filter;
+    //One JSON object per line, or comma separated values with a header
+    bool csv = false;
+    //Balls simulated by the physics benchmark
+    std::size_t balls = 100000;
+    //Size of the file streamed by the stream_checksum benchmark, pass a multiple of the RAM to measure the disk
+    std::size_t file_mb = 64;
+
+    /**
+     * @brief parse --warmups=N --repetitions=N --max-threads=N --filter=name --format=json|csv --balls=N --file-mb=N
+     * @param argc
+     * @param argv
+     * @return false on an unknown argument
+     */
+    bool parse(int argc, char* argv[])
+    {
+        for(int i=1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            if(arg.compare(0, 10, "--warmups=") == 0) warmups = std::strtoul(arg.c_str() + 10, nullptr, 10);
+            else if(arg.compare(0, 14, "--repetitions=") == 0) repetitions = std::max(1ul, std::strtoul(arg.c_str() + 14, nullptr, 10));
+            else if(arg.compare(0, 14, "--max-threads=") == 0) max_threads = std::max(1ul, std::strtoul(arg.c_str() + 14, nullptr, 10));
+            else if(arg.compare(0, 9, "--filter=") == 0) filter = arg.substr(9);
+            else if(arg == "--format=csv") csv = true;
+            else if(arg == "--format=json") csv = false;
+            else if(arg.compare(0, 8, "--balls=") == 0) balls = std::max(1ul, std::strtoul(arg.c_str() + 8, nullptr, 10));
+            else if(arg.compare(0, 10, "--file-mb=") == 0) file_mb = std::max(1ul, std::strtoul(arg.c_str() + 10, nullptr, 10));
+            else return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief thread_counts 1, 2, 4, ... up to max_threads
+     * @return
+     */
+    std::vector<std::size_t> thread_counts() const
+    {
+        std::vector<std::size_t> counts;
+        for(std::size_t threads=1; threads < max_threads; threads *= 2) counts.push_back(threads);
+        counts.push_back(max_threads);
+        return counts;
+    }
+};
+
+/**
+ * Runs a benchmark repeatedly and reports the median and 99th percentile cost per operation,
+ * in time stamp counter cycles and nanoseconds
+ */
+class BenchRunner
+{
+public:
+    explicit BenchRunner(const BenchOptions& options) :
+        m_options(options)
+    {
+        if(m_options.csv) std::printf("benchmark,threads,ops,repetitions,median_cycles,p99_cycles,median_ns,p99_ns\n");
+    }
+
+    const BenchOptions& options() const { return m_options; }
+
+    bool enabled(const char* name) const { return std::string(name).find(m_options.filter) != std::string::npos; }
+
+    /**
+     * @brief run Time repetition() after the warmups and print one result
+     * @param name
+     * @param threads Reported alongside the result
+     * @param ops Operations done by one call to repetition, the results are per operation
+     * @param repetition
+     */
+    template<typename Function>
+    void run(const char* name, std::size_t threads, std::size_t ops, Function repetition)
+    {
+        for(std::size_t i=0; i < m_options.warmups; i++) repetition();
+
+        std::vector<double> cycles;
+        std::vector<double> ns;
+        for(std::size_t i=0; i < m_options.repetitions; i++)
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const uint64_t start_ticks = read_timestamp();
+            repetition();
+            const uint64_t end_ticks = read_timestamp();
+            const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            cycles.push_back(static_cast<double>(end_ticks - start_ticks) / ops);
+            ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() / ops);
+        }
+        report(name, threads, ops, cycles, ns);
+    }
+
+private:
+    static double percentile(std::vector<double>& values, double fraction)
+    {
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1u, static_cast<std::size_t>(fraction * values.size()))];
+    }
+
+    void report(const char* name, std::size_t threads, std::size_t ops, std::vector<double>& cycles, std::vector<double>& ns)
+    {
+        const double median_cycles = percentile(cycles, 0.5);
+        const double p99_cycles = percentile(cycles, 0.99);
+        const double median_ns = percentile(ns, 0.5);
+        const double p99_ns = percentile(ns, 0.99);
+        if(m_options.csv)
+        {
+            std::printf("%s,%zu,%zu,%zu,%.2f,%.2f,%.2f,%.2f\n", name, threads, ops, m_options.repetitions,
+                        median_cycles, p99_cycles, median_ns, p99_ns);
+        }
+        else
+        {
+            std::printf("{\"benchmark\":\"%s\",\"threads\":%zu,\"ops\":%zu,\"repetitions\":%zu,"
+                        "\"median_cycles\":%.2f,\"p99_cycles\":%.2f,\"median_ns\":%.2f,\"p99_ns\":%.2f}\n",
+                        name, threads, ops, m_options.repetitions, median_cycles, p99_cycles, median_ns, p99_ns);
+        }
+        std::fflush(stdout);
+    }
+
+    BenchOptions m_options;
+};
+
+#endif // MJOB_BENCH_HPP
@@ -0,0 +1,553 @@
+#include "bench.hpp"
+#include "test/physics_world.h"
+#include "test/vector.h"
+
+//For std::fprintf
+#include <cstdio>
+//For std::thread
+#include <thread>
+//For open and posix_fadvise
+#include <fcntl.h>
+#include <unistd.h>
+//For std::filesystem::temp_directory_path
+#include <filesystem>
+//For errno and std::strerror
+#include <cerrno>
+#include <cstring>
+
+static void empty_job(const void*)
+{
+}
+
+//Busy work that the compiler cannot drop, roughly iterations nanoseconds
+static uint32_t spin_work(uint32_t iterations)
+{
+    uint32_t a = 0, b = 1;
+    for(uint32_t i=0; i < iterations; i++)
+    {
+        const uint32_t c = a + b;
+        a = b;
+        b = c;
+    }
+    return b;
+}
+
+/**
+ * Root plus 4095 empty children submitted from the thread that created the job system,
+ * measures the cost of creating, enqueueing, running and finishing a job
+ */
+void bench_empty_job(BenchRunner& runner)
+{
+    const std::size_t num_jobs = 4096;
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("empty_job", threads, num_jobs, [&]()
+        {
+            Job* root = job_system.create_job(empty_job);
+            for(std::size_t i=0; i < num_jobs - 1; i++)
+            {
+                job_system.enqueue(job_system.create_job_as_child(root, empty_job));
+            }
+            job_system.enqueue(root);
+            job_system.wait(root);
+        });
+    }
+}
+
+/**
+ * Same as empty_job, the children are created with create_children and submitted with one enqueue_batch
+ */
+void bench_empty_job_batch(BenchRunner& runner)
+{
+    const std::size_t num_jobs = 4096;
+    std::vector<Job*> children(num_jobs - 1);
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("empty_job_batch", threads, num_jobs, [&]()
+        {
+            Job* root = job_system.create_job(empty_job);
+            job_system.create_children(root, children.size(), empty_job, children.data());
+            job_system.enqueue_batch(children.data(), children.size());
+            job_system.enqueue(root);
+            job_system.wait(root);
+        });
+    }
+}
+
+static void fan_out_job(JobSystem* job_system, Job* root, int depth)
+{
+    if(depth == 0) return;
+    for(int i=0; i < 8; i++)
+    {
+        job_system->enqueue(job_system->create_job_as_child(root, [=]() { fan_out_job(job_system, root, depth - 1); }));
+    }
+}
+
+/**
+ * Every job spawns eight children down to depth five, each level spawned by whoever ran the parent
+ */
+void bench_fan_out(BenchRunner& runner)
+{
+    const int depth = 5;
+    std::size_t num_jobs = 0;
+    for(int d=0, n=1; d <= depth; d++, n *= 8) num_jobs += n;
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("fan_out", threads, num_jobs, [&]()
+        {
+            Job* root = job_system.create_job(empty_job);
+            job_system.enqueue(job_system.create_job_as_child(root, [&job_system, root]()
+            {
+                fan_out_job(&job_system, root, depth);
+            }));
+            job_system.enqueue(root);
+            job_system.wait(root);
+        });
+    }
+}
+
+/**
+ * Scale and offset an array of floats, reported per element
+ */
+void bench_parallel_for(BenchRunner& runner)
+{
+    const std::size_t count = 1u << 22;
+    std::vector<float> values(count, 1.0f);
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("parallel_for", threads, count, [&]()
+        {
+            job_system.parallel_for(std::size_t(0), count, 4096, [&values](std::size_t i)
+            {
+                values[i] = values[i] * 0.5f + 1.0f;
+            });
+        });
+    }
+}
+
+/**
+ * Every job starts out on the creating worker and one in sixteen is 32 times as expensive, so the
+ * other workers only get work by stealing
+ */
+void bench_imbalanced(BenchRunner& runner)
+{
+    const std::size_t num_jobs = 4096;
+    std::atomic<uint32_t> sink{0};
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("imbalanced", threads, num_jobs, [&]()
+        {
+            Job* root = job_system.create_job(empty_job);
+            for(std::size_t i=0; i < num_jobs - 1; i++)
+            {
+                const uint32_t work = i % 16 == 0 ? 32 * 256 : 256;
+                job_system.enqueue(job_system.create_job_as_child(root, [work, &sink]()
+                {
+                    sink.fetch_add(spin_work(work), std::memory_order_relaxed);
+                }));
+            }
+            job_system.enqueue(root);
+            job_system.wait(root);
+        });
+    }
+}
+
+/**
+ * Compute jobs next to a few jobs that sleep for a millisecond, as if reading a file. Once with the sleepers
+ * on the blocking pool and once run by the workers like any other job, reported per compute job
+ */
+void bench_mixed(BenchRunner& runner)
+{
+    const std::size_t num_jobs = 4096;
+    const std::size_t blocking_jobs = 8;
+    std::atomic<uint32_t> sink{0};
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        for(bool pool : {true, false})
+        {
+            runner.run(pool ? "mixed_blocking_pool" : "mixed_blocking_inline", threads, num_jobs, [&]()
+            {
+                Job* root = job_system.create_job(empty_job);
+                for(std::size_t i=0; i < blocking_jobs; i++)
+                {
+                    Job* job = job_system.create_job_as_child(root, []()
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    });
+                    if(pool) job_system.enqueue_blocking(job);
+                    else job_system.enqueue(job);
+                }
+                for(std::size_t i=0; i < num_jobs; i++)
+                {
+                    job_system.enqueue(job_system.create_job_as_child(root, [&sink]()
+                    {
+                        sink.fetch_add(spin_work(256), std::memory_order_relaxed);
+                    }));
+                }
+                job_system.enqueue(root);
+                job_system.wait(root);
+            });
+        }
+    }
+}
+
+/**
+ * Threads that are not workers submit batches through the injection queue and wait for them,
+ * one producer per worker thread. The thread that created the job system only joins the producers,
+ * so it gets an extra worker that never runs jobs
+ */
+void bench_producer_consumer(BenchRunner& runner)
+{
+    const std::size_t batches = 16;
+    const std::size_t jobs_per_batch = 64;
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads + 1u);
+        runner.run("producer_consumer", threads, threads * batches * jobs_per_batch, [&]()
+        {
+            std::vector<std::thread> producers;
+            for(std::size_t p=0; p < threads; p++)
+            {
+                producers.emplace_back([&]()
+                {
+                    for(std::size_t b=0; b < batches; b++)
+                    {
+                        Job* root = job_system.create_job(empty_job);
+                        for(std::size_t i=0; i < jobs_per_batch - 1; i++)
+                        {
+                            job_system.enqueue(job_system.create_job_as_child(root, empty_job));
+                        }
+                        job_system.enqueue(root);
+                        job_system.wait(root);
+                    }
+                });
+            }
+            for(std::thread& producer : producers) producer.join();
+        });
+    }
+}
+
+//The allocation scheme JobAllocator used before it became per worker, one counter shared by every thread
+struct SharedCounterAllocator
+{
+    Job* allocate()
+    {
+        uint32_t index = allocated_jobs.fetch_add(1, std::memory_order_relaxed);
+        return &jobs[index & JobAllocator::mask];
+    }
+    std::atomic<uint32_t> allocated_jobs{0};
+    Job jobs[JobAllocator::capacity];
+};
+
+/**
+ * Every thread allocates from it's own JobAllocator, reported per allocation of one thread.
+ * allocator_shared_counter is the same with one counter shared by all threads
+ */
+void bench_allocator(BenchRunner& runner)
+{
+    const std::size_t num_jobs = 1u << 16;
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        std::unique_ptr<SharedCounterAllocator> shared = std::make_unique<SharedCounterAllocator>();
+        runner.run("allocator_shared_counter", threads, num_jobs, [&]()
+        {
+            std::vector<std::thread> workers;
+            for(std::size_t t=0; t < threads; t++)
+            {
+                workers.emplace_back([&shared]()
+                {
+                    for(std::size_t i=0; i < num_jobs; i++)
+                    {
+                        Job* job = shared->allocate();
+                        //Threads land on the same slots once the counter wraps, only the atomic fields are written
+                        job->continuation_count.store(continuations_released, std::memory_order_relaxed);
+                        job->unfinished_jobs.store(0, std::memory_order_relaxed);
+                    }
+                });
+            }
+            for(std::thread& worker : workers) worker.join();
+        });
+
+        std::vector<std::unique_ptr<JobAllocator>> allocators;
+        for(std::size_t t=0; t < threads; t++) allocators.push_back(std::make_unique<JobAllocator>());
+        runner.run("allocator", threads, num_jobs, [&]()
+        {
+            std::vector<std::thread> workers;
+            for(std::size_t t=0; t < threads; t++)
+            {
+                workers.emplace_back([&allocators, t]()
+                {
+                    JobAllocator& allocator = *allocators[t];
+                    for(std::size_t i=0; i < num_jobs; i++)
+                    {
+                        Job* job = allocator.allocate();
+                        job->pfn = empty_job;
+                        //Never enqueued, leave the slot free so it can be reused
+                        job->continuation_count.store(continuations_released, std::memory_order_relaxed);
+                        job->unfinished_jobs.store(0, std::memory_order_relaxed);
+                    }
+                });
+            }
+            for(std::thread& worker : workers) worker.join();
+        });
+    }
+}
+
+/**
+ * One step of the physics demo without a window, grid build, collisions and integration all split into jobs.
+ * Reported per ball, run with --balls=1000000 to see how the scheduler copes once the arrays leave the cache
+ */
+void bench_physics(BenchRunner& runner)
+{
+    const std::size_t balls = runner.options().balls;
+    //Same density as the demo window, about one ball per 20x20
+    const float side = std::max(100.0f, std::sqrt(float(balls)) * 20.0f);
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        PhysicsWorld world(side, side, balls);
+        runner.run("physics", threads, balls, [&]()
+        {
+            world.step(&job_system);
+        });
+    }
+}
+
+/**
+ * Normalizes an array of 3D vectors in place, once with the batch kernel and once through v3, reported per vector
+ */
+void bench_normalize(BenchRunner& runner)
+{
+    const std::size_t count = 1u << 20;
+    std::vector<float> x(count, 1.0f), y(count, 2.0f), z(count, 3.0f);
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("normalize_batch", threads, count, [&]()
+        {
+            job_system.parallel_range(std::size_t(0), count, 4096, [&](std::size_t begin, std::size_t end)
+            {
+                batch_normalize(x.data(), y.data(), z.data(), begin, end);
+            });
+        });
+        runner.run("normalize_scalar", threads, count, [&]()
+        {
+            job_system.parallel_range(std::size_t(0), count, 4096, [&](std::size_t begin, std::size_t end)
+            {
+                for(std::size_t i=begin; i < end; i++)
+                {
+                    const v3 n = v3(x[i], y[i], z[i]).unit_vector();
+                    x[i] = n.x;
+                    y[i] = n.y;
+                    z[i] = n.z;
+                }
+            });
+        });
+    }
+}
+
+/**
+ * Velocity and position update of 2D particles under gravity, the fused batch kernel against a loop over v2
+ */
+void bench_integrate(BenchRunner& runner)
+{
+    const std::size_t count = 1u << 20;
+    std::vector<float> px(count, 0.0f), py(count, 0.0f), vx(count, 1.0f), vy(count, 0.0f);
+    const v2 gravity(0.0f, -9.81f);
+    const float dt = 1.0f / 60.0f;
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        JobSystem job_system(threads);
+        runner.run("integrate_batch", threads, count, [&]()
+        {
+            job_system.parallel_range(std::size_t(0), count, 4096, [&](std::size_t begin, std::size_t end)
+            {
+                batch_integrate(px.data(), py.data(), vx.data(), vy.data(), gravity, dt, begin, end);
+            });
+        });
+        runner.run("integrate_scalar", threads, count, [&]()
+        {
+            job_system.parallel_range(std::size_t(0), count, 4096, [&](std::size_t begin, std::size_t end)
+            {
+                for(std::size_t i=begin; i < end; i++)
+                {
+                    const v2 v = v2(vx[i], vy[i]) + gravity * dt;
+                    const v2 p = v2(px[i], py[i]) + v * dt;
+                    vx[i] = v.x;
+                    vy[i] = v.y;
+                    px[i] = p.x;
+                    py[i] = p.y;
+                }
+            });
+        });
+    }
+}
+
+//FNV-1a over 64 bit words
+static uint64_t checksum(const unsigned char* data, std::size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(std::size_t i=0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+struct StreamContext
+{
+    static constexpr std::size_t chunk_size = 1u << 20;
+
+    JobSystem* job_system;
+    Job* root;
+    int fd;
+    std::size_t chunks;
+    //Each slot owns a buffer and streams every slots'th chunk through it
+    std::size_t slots;
+    std::vector<std::vector<unsigned char>> buffers;
+    std::vector<IoRequest> requests;
+    std::vector<uint64_t> checksums;
+};
+
+/**
+ * Read chunk into the slot's buffer, a continuation of the read checksums it and reads the slot's next chunk
+ */
+static void stream_chunk(StreamContext* context, std::size_t slot, std::size_t chunk)
+{
+    JobSystem& job_system = *context->job_system;
+    IoRequest& request = context->requests[slot];
+    request.fd = context->fd;
+    request.buffer = context->buffers[slot].data();
+    request.size = StreamContext::chunk_size;
+    request.offset = uint64_t(chunk) * StreamContext::chunk_size;
+    Job* read = job_system.create_job_as_child(context->root, empty_job);
+    job_system.add_continuation(read, job_system.create_job_as_child(context->root, [context, slot, chunk]()
+    {
+        const IoRequest& request = context->requests[slot];
+        const std::size_t size = request.result > 0 ? static_cast<std::size_t>(request.result) : 0u;
+        context->checksums[chunk] = checksum(context->buffers[slot].data(), size);
+        if(chunk + context->slots < context->chunks) stream_chunk(context, slot, chunk + context->slots);
+    }));
+    job_system.submit_read(read, &request);
+    job_system.enqueue(read);
+}
+
+/**
+ * Streams a file, --file-mb sized, in 1 MiB chunks and checksums every chunk in a job as soon as it's read completed.
+ * The page cache is dropped for the file before every repetition, reported per chunk.
+ * Once with io_uring and once with the reads on the blocking pool
+ */
+void bench_stream_checksum(BenchRunner& runner)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "mjob_bench_stream.bin";
+    const std::size_t chunks = runner.options().file_mb;
+    {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(fd < 0)
+        {
+            std::fprintf(stderr, "stream_checksum: could not create %s: %s\n", path.c_str(), std::strerror(errno));
+            return;
+        }
+        std::vector<unsigned char> chunk(StreamContext::chunk_size);
+        for(std::size_t c=0; c < chunks; c++)
+        {
+            for(std::size_t i=0; i < chunk.size(); i++) chunk[i] = static_cast<unsigned char>(c + i * 7u);
+            if(::write(fd, chunk.data(), chunk.size()) != static_cast<ssize_t>(chunk.size()))
+            {
+                std::fprintf(stderr, "stream_checksum: could not write %s\n", path.c_str());
+                ::close(fd);
+                std::filesystem::remove(path);
+                return;
+            }
+        }
+        //Only clean pages can be dropped from the page cache
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::fprintf(stderr, "stream_checksum: could not open %s: %s\n", path.c_str(), std::strerror(errno));
+        std::filesystem::remove(path);
+        return;
+    }
+    for(std::size_t threads : runner.options().thread_counts())
+    {
+        for(bool io_uring : {true, false})
+        {
+            IoPolicy io_policy;
+            io_policy.use_io_uring = io_uring;
+            JobSystem job_system(threads, IdlePolicy(), StealPolicy(), AffinityPolicy(), BlockingPolicy(), io_policy);
+            if(io_uring && !job_system.uses_io_uring()) continue;
+
+            StreamContext context;
+            context.job_system = &job_system;
+            context.fd = fd;
+            context.chunks = chunks;
+            context.slots = std::min<std::size_t>(chunks, 32u);
+            context.buffers.assign(context.slots, std::vector<unsigned char>(StreamContext::chunk_size));
+            context.requests.resize(context.slots);
+            context.checksums.resize(chunks);
+            runner.run(io_uring ? "stream_checksum_uring" : "stream_checksum_pool", threads, chunks, [&]()
+            {
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                context.root = job_system.create_job(empty_job);
+                for(std::size_t slot=0; slot < context.slots; slot++)
+                {
+                    stream_chunk(&context, slot, slot);
+                }
+                job_system.enqueue(context.root);
+                job_system.wait(context.root);
+            });
+        }
+    }
+    ::close(fd);
+    std::filesystem::remove(path);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if(!options.parse(argc, argv))
+    {
+        std::fprintf(stderr, "usage: %s [--warmups=N] [--repetitions=N] [--max-threads=N] [--filter=name] "
+                             "[--format=json|csv] [--balls=N] [--file-mb=N]\n", argv[0]);
+        return 1;
+    }
+    BenchRunner runner(options);
+
+    struct Benchmark
+    {
+        const char* name;
+        void (*run)(BenchRunner&);
+    };
+    const Benchmark benchmarks[] =
+    {
+        {"empty_job", bench_empty_job},
+        {"empty_job_batch", bench_empty_job_batch},
+        {"fan_out", bench_fan_out},
+        {"parallel_for", bench_parallel_for},
+        {"imbalanced", bench_imbalanced},
+        {"producer_consumer", bench_producer_consumer},
+        {"mixed", bench_mixed},
+        {"allocator", bench_allocator},
+        {"physics", bench_physics},
+        {"normalize", bench_normalize},
+        {"integrate", bench_integrate},
+        {"stream_checksum", bench_stream_checksum},
+    };
+    for(const Benchmark& benchmark : benchmarks)
+    {
+        if(runner.enabled(benchmark.name)) benchmark.run(runner);
+    }
+    return 0;
+}
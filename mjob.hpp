@@ -11,338 +11,3481 @@
 #include <thread>
 //For assert
 #include <assert.h>
+//For intptr_t
+#include <cstdint>
+#include <cstdlib>
+//For offsetof
+#include <cstddef>
+//For std::mutex
+#include <mutex>
+//For std::condition_variable
+#include <condition_variable>
+//For std::chrono::duration
+#include <chrono>
+//For std::deque
+#include <deque>
+//For std::initializer_list
+#include <initializer_list>
+//For std::function
+#include <functional>
+//For std::max
+#include <algorithm>
+#include <limits>
+//For placement new
+#include <new>
+//For std::decay and std::enable_if
+#include <type_traits>
+//For std::string
+#include <string>
+//For std::ifstream
+#include <fstream>
+//For std::filesystem::directory_iterator
+#include <filesystem>
+//For std::ostream
+#include <ostream>
+//For errno
+#include <cerrno>
+//For std::memset
+#include <cstring>
+#ifdef __linux__
+//For pthread_setaffinity_np
+#include <pthread.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+//For pread and pwrite
+#include <unistd.h>
+#endif
+
+//io_uring is used through the raw system calls, liburing is not needed
+#if !defined(MJOB_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MJOB_IO_URING 1
+#endif
+#endif
+#ifndef MJOB_IO_URING
+#define MJOB_IO_URING 0
+#endif
+#if MJOB_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 //See https://blog.molecular-matters.com/2015/08/24/job-system-2-0-lock-free-work-stealing-part-1-basics/
 
+//Size of the unit the cpu keeps coherent, data written by different threads is kept on separate lines
+constexpr std::size_t cache_line_size = 64u;
+
+//Define as 0 to compile the per worker statistics out
+#ifndef MJOB_STATS
+#define MJOB_STATS 1
+#endif
+constexpr bool stats_enabled = MJOB_STATS != 0;
+
+//Define as 1 to compile in tracing of every job, see JobSystem::set_tracing
+#ifndef MJOB_TRACE
+#define MJOB_TRACE 0
+#endif
+constexpr bool trace_enabled = MJOB_TRACE != 0;
+
 using JobFunction = std::add_pointer<void(const void*)>::type;
-struct Job
+
+/**
+ * Every worker has one queue per priority and always takes the most important job it can find,
+ * except that every few jobs lower priorities go first so they never starve
+ */
+enum class JobPriority : uint8_t
+{
+    high = 0,
+    normal = 1,
+    low = 2,
+};
+
+constexpr std::size_t num_priorities = 3u;
+
+//Alignment of Job::payload, callables aligned stricter than this are stored out of line
+constexpr std::size_t payload_alignment = 16u;
+
+/**
+ * Three cache lines, the first one holds everything touched to run and finish a job,
+ * the other two are only read when the job has a parent or continuations
+ */
+struct alignas(cache_line_size) Job
 {
     JobFunction pfn;
-    Job* parent;
     std::atomic<uint32_t> unfinished_jobs;
-    char padding[48];
     std::atomic<uint32_t> continuation_count;
-    Job* continuations[15];
+    //Passed to pfn, holds the callable for jobs created from lambdas and functors
+    alignas(payload_alignment) char payload[48];
+
+    Job* parent;
+    //Filled in by add_continuation, possibly while the job runs, see continuations_closed
+    std::atomic<Job*> continuations[14];
+    JobPriority priority;
+    //Run on the blocking pool instead of a worker, see JobSystem::enqueue_blocking. Cleared once the pool picks it up
+    bool blocking = false;
+    //Number of threads inside JobSystem::wait and friends for this job. Finishing the job only wakes up
+    //parked waiters when non zero, and the slot is not handed out again before it drops back to zero
+    mutable std::atomic<uint32_t> waiters{0};
 };
 
-template<std::size_t Size = 4096u,
-          std::size_t Mask = Size - 1u>
+static_assert(sizeof(Job) == 3 * cache_line_size, "Job must fill exactly three cache lines");
+static_assert(offsetof(Job, unfinished_jobs) / cache_line_size == offsetof(Job, continuation_count) / cache_line_size,
+              "The job counters must share a cache line");
+static_assert(offsetof(Job, payload) + sizeof(Job::payload) == cache_line_size, "The payload must end the first cache line");
+static_assert(offsetof(Job, payload) % payload_alignment == 0, "The payload must be aligned to payload_alignment");
+
+constexpr uint32_t max_continuations = sizeof(Job::continuations) / sizeof(Job::continuations[0]);
+
+/**
+ * continuation_count is the number of continuations while the job is in flight. The worker finishing
+ * the job sets continuations_closed so no continuation can be added anymore, and once it is done
+ * running them it stores continuations_released which marks the slot as free
+ */
+constexpr uint32_t continuations_closed = 1u << 31;
+constexpr uint32_t continuations_released = ~0u;
+
+/**
+ * @brief is_job_free A job slot is free once the job and all it's children has finished,
+ * the finishing worker is done reading it's continuations and nobody is waiting on it anymore
+ * @param job
+ * @return
+ */
+inline bool is_job_free(const Job* job)
+{
+    return job->unfinished_jobs.load(std::memory_order_acquire) == 0 &&
+           job->continuation_count.load(std::memory_order_acquire) == continuations_released &&
+           job->waiters.load(std::memory_order_acquire) == 0;
+}
+
+/**
+ * @brief cpu_relax Tell the cpu we are in a spin loop
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief read_timestamp Cheap timestamp for tracing, the time stamp counter where there is one
+ * @return
+ */
+inline uint64_t read_timestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/**
+ * Chase-Lev work stealing deque with a growable circular buffer, the owner pushes and pops at the bottom
+ * while thieves steal from the top. Memory ordering follows
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli 2013)
+ * so it is correct on ARM as well as x86.
+ */
+template<std::size_t InitialCapacity = 4096u>
 class WorkStealingQueue
 {
+    static_assert((InitialCapacity & (InitialCapacity - 1u)) == 0, "InitialCapacity must be a power of two");
 public:
+    WorkStealingQueue()
+    {
+        m_buffers.push_back(std::make_unique<Buffer>(InitialCapacity));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    //NOTE: Not threadsafe, must only be called from the owner's thread
     void push(Job* job)
     {
         //Push only changes bottom
-        long b = m_bottom;
-        m_jobs[b& Mask] = job;
-        //Ensure the job is written before b+1 is published on x86/64, a compiler barrier is enough
-        asm volatile("": : :"memory");
-        m_bottom = b + 1;
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_acquire);
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+        if(b - t > static_cast<int64_t>(buffer->mask))
+        {
+            //Full, this is the only place the deque allocates
+            buffer = grow(buffer, b, t);
+        }
+        buffer->put(b, job);
+        //Publish the job to thieves, the release makes sure the job is written before b+1 is visible
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief push_batch Push count jobs, jobs[count - 1] ends up at the bottom. Thieves see the whole batch
+     * at once, it is published with a single store to bottom
+     * NOTE: Not threadsafe, must only be called from the owner's thread
+     * @param jobs
+     * @param count
+     */
+    void push_batch(Job* const* jobs, std::size_t count)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_acquire);
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+        while(b - t + static_cast<int64_t>(count) > static_cast<int64_t>(buffer->mask + 1u))
+        {
+            buffer = grow(buffer, b, t);
+        }
+        for(std::size_t i=0; i < count; i++)
+        {
+            buffer->put(b + static_cast<int64_t>(i), jobs[i]);
+        }
+        m_bottom.store(b + static_cast<int64_t>(count), std::memory_order_release);
     }
 
+    //NOTE: Not threadsafe, must only be called from the owner's thread
     Job* pop()
     {
         //Pop only changes bottom
-        long b = m_bottom - 1;
-        //Hardware barrier to  make sure bottom is written before top is read
-        //The x86 memory model explicitly allows that
-        //"Loads may be reordered with older stores to different locations"
-        //Which is exactly the case here
-        //__sync_synchronize();
-        //It turns out that Exchange is faster than the HW barrier
-        //However exchange essentially works as a HW barrier too
-        __sync_lock_test_and_set(&m_bottom, b);
-        long t = m_top;
+        const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        //Bottom must be written before top is read, a store followed by a load of a different location
+        //may be reordered even on x86, so this needs a full fence
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
         if(t <= b)
         {
-            Job* job = m_jobs[b & Mask];
+            Job* job = buffer->get(b);
             //There is still more than one item left in the queue
             if(t != b) return job;
             //This is the last item in the queue
             //failed race against steal operation
-            if(__sync_val_compare_and_swap(&m_top, t, t + 1) != t) job = nullptr;
-            m_bottom = t + 1;
+            if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                job = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
             return job;
         }
         else
         {
-            m_bottom = t;
+            m_bottom.store(b + 1, std::memory_order_relaxed);
             return nullptr;
         }
     }
 
+    //Threadsafe, may be called from any thread
     Job* steal()
     {
         //Steal only changes top
-        long t = m_top;
-        //Ensure that top is always read before bottom
-        //loads will not be reordered with other loads on x86
-        asm volatile("": : :"memory");
-        long b = m_bottom;
+        int64_t t = m_top.load(std::memory_order_acquire);
+        //Top must be read before bottom and ordered against the fence in pop
+#if defined(__x86_64__) || defined(__i386__)
+        //Loads are never reordered with other loads on x86 and stores are seen in the same order
+        //by every core, so together with the full fence in pop a compiler barrier is enough
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#else
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+        const int64_t b = m_bottom.load(std::memory_order_acquire);
         if(t < b)
         {
-            Job* job = m_jobs[t & Mask];
+            //The buffer is never freed while the queue is alive, so it is safe to read from
+            //even if the owner has grown the queue since
+            Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+            Job* job = buffer->get(t);
             //Check if any modifications was done to T
             //If there was a concurrent modification, fail the steal
-            if(__sync_val_compare_and_swap(&m_top, t, t + 1) != t) return nullptr;
+            if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
             //The exchg was successful return the new job
             return job;
         }
         return nullptr;
     }
 
-    bool is_empty() const { return m_bottom <= m_top; }
-    std::size_t size() const { return m_bottom - m_top; }
+    bool is_empty() const { return size() == 0; }
+    std::size_t size() const
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<std::size_t>(b - t) : 0u;
+    }
+    std::size_t capacity() const { return m_buffer.load(std::memory_order_relaxed)->mask + 1u; }
 
 private:
-    Job* m_jobs[Size];
-    uint32_t m_bottom = 0;
-    uint32_t m_top = 0;
-};
-
-
-class JobWorker
-{
-public:
-    JobWorker(uint8_t worker_idx, uint8_t num_workers, WorkStealingQueue<>** queues) :
-        m_worker_idx(worker_idx),
-        m_num_workers(num_workers),
-        m_queues(queues)
-    {}
-
-    ~JobWorker() {}
-
-    void set_active(bool active) { m_active = active; }
-    bool is_empty_job(Job* job) { return job == nullptr; }
+    struct Buffer
+    {
+        explicit Buffer(std::size_t capacity) :
+            mask(capacity - 1u),
+            jobs(new std::atomic<Job*>[capacity])
+        {}
 
-    //NOTE: Not threadsafe, must be called from worker threads thread
-    void run(Job* job) { get_queue()->push(job); }
+        Job* get(int64_t index) const { return jobs[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, Job* job) { jobs[index & mask].store(job, std::memory_order_relaxed); }
 
-    /**
-     * @brief get_queue
-     * @return
-     */
-    WorkStealingQueue<>* get_queue() { return m_queues[m_worker_idx]; }
+        const std::size_t mask;
+        std::unique_ptr<std::atomic<Job*>[]> jobs;
+    };
 
     /**
-     * @brief get_thread Get the thread associated with this worker
-     * @return
+     * @brief grow Double the capacity, copying the live range [t, b) into the new buffer.
+     * The old buffer is retired rather than freed as thieves may still be reading from it,
+     * retired buffers add up to less than the current one and are freed with the queue.
      */
-    std::thread& get_thread() { return m_thread; }
+    Buffer* grow(Buffer* buffer, int64_t b, int64_t t)
+    {
+        m_buffers.push_back(std::make_unique<Buffer>((buffer->mask + 1u) * 2u));
+        Buffer* grown = m_buffers.back().get();
+        for(int64_t i=t; i < b; i++)
+        {
+            grown->put(i, buffer->get(i));
+        }
+        m_buffer.store(grown, std::memory_order_release);
+        return grown;
+    }
 
-    /**
-     * @brief set_thread Set the thread assocciated with this worker
-     * @param thread
-     */
-    void set_thread(std::thread&& thread) { m_thread = std::move(thread); }
+    //Top is CASed by thieves and bottom is written by the owner on every push and pop,
+    //keep them on separate cache lines so steals and pushes do not invalidate each other
+    alignas(cache_line_size) std::atomic<int64_t> m_top{0};
+    alignas(cache_line_size) std::atomic<int64_t> m_bottom{0};
+    std::atomic<Buffer*> m_buffer{nullptr};
+    //Every buffer this queue has used, only touched by the owner
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+};
 
-    /**
-     * @brief thread_function Main loop, fetch and execute will yield if there is no job available
-     */
-    void thread_function() { while(m_active) fetch_and_execute(); }
+static_assert(alignof(WorkStealingQueue<>) == cache_line_size, "WorkStealingQueue must start on a cache line");
+static_assert(sizeof(WorkStealingQueue<>) % cache_line_size == 0, "WorkStealingQueue must fill whole cache lines");
 
 
-    /**
-     * @brief fetch_and_execute Attempt to fetch and execute a job
-     */
-    void fetch_and_execute() { if(Job* job = get_job()) execute_job(job); }
-private:
+/**
+ * Bounded multi-producer multi-consumer queue used to hand jobs from any thread to the workers
+ * See http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template<std::size_t Size = 4096u,
+          std::size_t Mask = Size - 1u>
+class InjectionQueue
+{
+public:
+    InjectionQueue()
+    {
+        for(std::size_t i=0; i < Size; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
 
     /**
-     * @brief execute_job
+     * @brief push Threadsafe, may be called from any thread
      * @param job
+     * @return false if the queue is full
      */
-    void execute_job(Job* job)
+    bool push(Job* job)
     {
-        job->padding[0] = static_cast<char>('0' + m_worker_idx);
-        job->pfn(job->padding);
-        finish(job);
-        //For statistics
-        m_jobs_completed++;
+        Cell* cell;
+        std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            cell = &m_cells[pos & Mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0)
+            {
+                //The cell is free, try to claim it
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if(diff < 0)
+            {
+                //The cell still holds a job from the previous lap
+                return false;
+            }
+            else
+            {
+                //Another producer claimed the cell first
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->job = job;
+        //Publish the job to the consumers
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
     }
 
     /**
-     * @brief get_job
-     * @return
+     * @brief pop Threadsafe, may be called from any thread
+     * @return nullptr if the queue is empty
      */
-    Job* get_job()
+    Job* pop()
     {
-        WorkStealingQueue<>* queue = get_queue();
-        Job* job = queue->pop();
-        if(is_empty_job(job))
+        Cell* cell;
+        std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for(;;)
         {
-            unsigned int rnd = (m_steal_from_queue++) % m_num_workers;
-            if(rnd == m_worker_idx)
+            cell = &m_cells[pos & Mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0)
             {
-                std::this_thread::yield();
-                return nullptr;
+                //The cell holds a job, try to claim it
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
             }
-            WorkStealingQueue<>* steal_queue = m_queues[rnd];
-            Job* stolen_job = steal_queue->steal();
-            if(is_empty_job(stolen_job))
+            else if(diff < 0)
             {
-                //We couldn't steal a job from the other queue either
-                std::this_thread::yield();
+                //Nothing has been published to the cell yet
                 return nullptr;
             }
-            return stolen_job;
+            else
+            {
+                //Another consumer claimed the cell first
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
         }
+        Job* job = cell->job;
+        //Hand the cell back to the producers for the next lap
+        cell->sequence.store(pos + Mask + 1, std::memory_order_release);
         return job;
     }
 
-    /**
-     * @brief finish
-     * @param job
-     */
-    void finish(Job* job)
+    bool is_empty() const
     {
-        const uint32_t unfinished_jobs = --job->unfinished_jobs;
-        if(unfinished_jobs == 0 && job->parent)
-        {
-            finish(job->parent);
-        }
+        return m_dequeue_pos.load(std::memory_order_relaxed) >= m_enqueue_pos.load(std::memory_order_relaxed);
     }
 
-    bool m_active = false;
-    uint8_t m_worker_idx;
-    uint8_t m_num_workers;
-    WorkStealingQueue<>** m_queues;
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        Job* job;
+    };
 
-    std::thread m_thread;
-    uint32_t m_jobs_completed = 0;
-    uint32_t m_steal_from_queue = 0;
+    Cell m_cells[Size];
+    //Producers and consumers each get their own cache line
+    alignas(cache_line_size) std::atomic<std::size_t> m_enqueue_pos{0};
+    alignas(cache_line_size) std::atomic<std::size_t> m_dequeue_pos{0};
 };
 
-class JobAllocator
+/**
+ * Ring of bytes holding callables that do not fit in Job::payload. Blocks are handed out in order
+ * and reclaimed in the same order once the job owning them is free, a block is never reused while
+ * it's job is still in flight. Detached blocks have no job and are reclaimed once released instead.
+ */
+class PayloadArena
 {
 public:
-    Job* allocate()
+    static constexpr std::size_t capacity = 64u * 1024u;
+    static constexpr std::size_t alignment = 16u;
+
+    /**
+     * @brief allocate
+     * NOTE: Not threadsafe
+     * @param owner The job the storage belongs to
+     * @param size
+     * @return nullptr if the arena is full of blocks whose jobs are still in flight
+     */
+    void* allocate(const Job* owner, std::size_t size)
+    {
+        const std::size_t block_size = sizeof(BlockHeader) + align_up(size);
+        assert(block_size <= capacity);
+        std::size_t offset = m_head % capacity;
+        //Blocks never wrap, the tail end of the ring is skipped instead
+        const std::size_t skipped = offset + block_size > capacity ? capacity - offset : 0;
+        while(capacity - (m_head - m_tail) < skipped + block_size)
+        {
+            if(!reclaim()) return nullptr;
+        }
+        if(skipped != 0)
+        {
+            new (m_buffer + offset) BlockHeader{nullptr, static_cast<uint32_t>(skipped), {1u}};
+            m_head += skipped;
+            offset = 0;
+        }
+        new (m_buffer + offset) BlockHeader{owner, static_cast<uint32_t>(block_size), {owner ? 1u : 0u}};
+        m_head += block_size;
+        return m_buffer + offset + sizeof(BlockHeader);
+    }
+
+    /**
+     * @brief allocate_detached Allocate storage that is not owned by a job, such as a coroutine frame
+     * NOTE: Not threadsafe
+     * @param size
+     * @return nullptr if the arena is full of blocks that are still in use
+     */
+    void* allocate_detached(std::size_t size) { return allocate(nullptr, size); }
+
+    /**
+     * @brief release Release storage returned by allocate_detached, threadsafe
+     * @param storage
+     */
+    static void release(void* storage)
     {
-        uint32_t index = m_allocated_jobs++;
-        return &m_jobs[(index - 1u) & (4096 - 1u)];
+        BlockHeader* header = reinterpret_cast<BlockHeader*>(static_cast<unsigned char*>(storage) - sizeof(BlockHeader));
+        header->released.store(1u, std::memory_order_release);
     }
+
 private:
-    std::atomic<uint32_t> m_allocated_jobs;
-    Job m_jobs[4096];
-};
+    struct alignas(alignment) BlockHeader
+    {
+        const Job* owner;
+        uint32_t size;
+        //Only used by detached blocks, blocks owned by a job are done once the job is free
+        std::atomic<uint32_t> released;
+    };
 
-class JobSystem
-{
-public:
+    static std::size_t align_up(std::size_t size) { return (size + alignment - 1u) & ~(alignment - 1u); }
 
     /**
-     * @brief
-     * JobSystem Create a new job system, this should preferably be a singleton
-     * as the job system creates one thread per "hardware" thread
+     * @brief reclaim Reclaim the oldest block if it's job is free
+     * @return
      */
-    JobSystem(std::size_t num_workers = std::thread::hardware_concurrency())
+    bool reclaim()
     {
-        //Initialize workers
-        assert(num_workers != 0);
+        if(m_tail == m_head) return false;
+        const BlockHeader* header = reinterpret_cast<const BlockHeader*>(m_buffer + m_tail % capacity);
+        if(header->owner ? !is_job_free(header->owner) : header->released.load(std::memory_order_acquire) == 0) return false;
+        m_tail += header->size;
+        return true;
+    }
 
-        m_workers.resize(num_workers);
-        m_queues.resize(num_workers);
+    alignas(alignment) unsigned char m_buffer[capacity];
+    //Bytes handed out and reclaimed since creation, their difference is the number of bytes in use
+    std::size_t m_head = 0;
+    std::size_t m_tail = 0;
+};
 
-        //Create queues
-        for(std::size_t i=0; i < num_workers; i++)
-        {
-            m_queues[i] = new WorkStealingQueue<>();
-        }
+class JobAllocator
+{
+public:
+    static constexpr uint32_t capacity = 4096u;
+    static constexpr uint32_t mask = capacity - 1u;
 
-        //Create workers
-        m_workers[0] = std::make_unique<JobWorker>(0, num_workers, m_queues.data());
-        for(std::size_t i=1; i < num_workers; i++)
-        {
-            m_workers[i] = std::make_unique<JobWorker>(i, num_workers, m_queues.data());
-            m_workers[i]->set_active(true);
-        }
-        //Start workers
-        for(std::size_t i=1; i < num_workers; i++)
+    JobAllocator()
+    {
+        //Every slot starts out free
+        for(Job& job : m_jobs)
         {
-            m_workers[i]->set_thread(std::thread(&JobWorker::thread_function, m_workers[i].get()));
+            job.unfinished_jobs = 0;
+            job.continuation_count = continuations_released;
+            for(std::atomic<Job*>& continuation : job.continuations) continuation = nullptr;
         }
     }
 
-    ~JobSystem()
+    /**
+     * @brief allocate Allocate a job from the ring, slots that are still in flight are skipped
+     * NOTE: Not threadsafe, must only be called from the owning worker's thread
+     * @return nullptr if every slot is still in flight
+     */
+    Job* allocate()
     {
-        for(std::size_t i=1; i < m_workers.size(); i++)
-        {
-            m_workers[i]->set_active(false);
-            m_workers[i]->get_thread().join();
-        }
-        m_workers.clear();
-        //Destroy all queues
-        for(std::size_t i=0; i < m_queues.size(); i++)
+        for(uint32_t probe=0; probe < capacity; probe++)
         {
-            delete m_queues[i];
+            Job* job = &m_jobs[m_allocated_jobs++ & mask];
+            if(is_job_free(job)) return job;
         }
-        m_queues.clear();
+        return nullptr;
     }
 
     /**
-     * @brief create_job
-     * @param function
-     * @return
+     * @brief allocate_payload Allocate storage for a callable that does not fit in Job::payload
+     * NOTE: Not threadsafe, must only be called from the owning worker's thread
+     * @param owner
+     * @param size
+     * @return nullptr if the arena is full of blocks whose jobs are still in flight
      */
-    Job* create_job(JobFunction function)
-    {
-        Job* job = m_job_allocator.allocate();
-        job->pfn = function;
-        job->parent = nullptr;
-        job->unfinished_jobs = 1;
-        return job;
-    }
+    void* allocate_payload(const Job* owner, std::size_t size) { return m_arena.allocate(owner, size); }
 
     /**
-     * @brief create_job_as_child
-     * @param parent
-     * @param function
-     * @return
+     * @brief allocate_frame Allocate storage that lives until PayloadArena::release is called on it, such as a
+     * coroutine frame. Frames get their own arena, so a long lived frame never holds back job payloads
+     * NOTE: Not threadsafe, must only be called from the owning worker's thread
+     * @param size
+     * @return nullptr if the arena is full of frames that are still in use
      */
-    Job* create_job_as_child(Job* parent, JobFunction function)
-    {
-        //Atomic increment
-        parent->unfinished_jobs++;
+    void* allocate_frame(std::size_t size) { return m_frame_arena.allocate_detached(size); }
 
-        Job* job = m_job_allocator.allocate();
-        job->pfn = function;
-        job->parent = parent;
-        job->unfinished_jobs = 1;
-        return job;
+private:
+    uint32_t m_allocated_jobs = 0;
+    Job m_jobs[capacity];
+    PayloadArena m_arena;
+    PayloadArena m_frame_arena;
+};
+
+class SharedJobAllocator
+{
+public:
+    static constexpr uint32_t capacity = 4096u;
+    static constexpr uint32_t mask = capacity - 1u;
+
+    SharedJobAllocator()
+    {
+        //Every slot starts out free
+        for(Job& job : m_jobs)
+        {
+            job.unfinished_jobs = 0;
+            job.continuation_count = continuations_released;
+            for(std::atomic<Job*>& continuation : job.continuations) continuation = nullptr;
+        }
     }
 
     /**
-     * @brief enqueue Enqueue the given job
-     * @param job
+     * @brief allocate Allocate a job from the ring, slots that are still in flight are skipped
+     * Threadsafe, used for jobs created by threads that are not workers
+     * @return nullptr if every slot is still in flight
      */
-    void enqueue(Job* job)
+    Job* allocate()
     {
-        m_workers[0]->run(job);
+        for(uint32_t probe=0; probe < capacity; probe++)
+        {
+            Job* job = &m_jobs[m_allocated_jobs.fetch_add(1, std::memory_order_relaxed) & mask];
+            //Claim the slot, two threads may land on the same slot after the counter wraps.
+            //Released is only stored once the previous job is done with the slot, so claiming it on that field
+            //can not pick up a slot that was handed out and finished again between a check and the claim
+            //Slots that are still waited on are skipped, the waiter would see the next job instead
+            if(job->waiters.load(std::memory_order_acquire) != 0) continue;
+            uint32_t released = continuations_released;
+            if(job->continuation_count.compare_exchange_strong(released, 0, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                job->unfinished_jobs.store(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        return nullptr;
     }
 
     /**
-     * @brief has_job_completed Check whether the given job and all it's children has finished execution
-     * @param job
-     * @return
+     * @brief allocate_payload Allocate storage for a callable that does not fit in Job::payload
+     * Threadsafe, the arena is guarded by a spin lock as this is the slow path of the slow path
+     * @param owner
+     * @param size
+     * @return nullptr if the arena is full of blocks whose jobs are still in flight
      */
-    bool has_job_completed(const Job* job) const { return job->unfinished_jobs == 0; }
+    void* allocate_payload(const Job* owner, std::size_t size)
+    {
+        while(m_arena_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+        void* storage = m_arena.allocate(owner, size);
+        m_arena_lock.clear(std::memory_order_release);
+        return storage;
+    }
+
+private:
+    std::atomic<uint32_t> m_allocated_jobs{0};
+    Job m_jobs[capacity];
+    std::atomic_flag m_arena_lock = ATOMIC_FLAG_INIT;
+    PayloadArena m_arena;
+};
+
+/**
+ * Configures what an idle worker does when it finds no job.
+ * It first spins with a pause instruction, then yields it's time slice and finally parks
+ * until a job is enqueued
+ */
+struct IdlePolicy
+{
+    //Failed attempts to get a job spent spinning
+    uint32_t spin_count = 64;
+    //Failed attempts to get a job spent yielding, after spinning
+    uint32_t yield_count = 16;
+    //Park the worker once it is done yielding, otherwise keep yielding forever
+    bool park = true;
+};
+
+/**
+ * Counter written by a single thread and read by any. Uses a relaxed load and store instead of
+ * an atomic increment, so it costs the same as a plain variable
+ */
+class StatCounter
+{
+public:
+    void add(uint64_t n) { m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    void raise_to(uint64_t n)
+    {
+        if(n > m_value.load(std::memory_order_relaxed)) m_value.store(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+/**
+ * Snapshot of what a worker did since it was created
+ */
+struct WorkerStats
+{
+    uint64_t executed = 0;
+    //Jobs taken from other workers, including those moved into our own queue by steal_half
+    uint64_t stolen = 0;
+    //Steal attempts that found the victim's queue empty
+    uint64_t failed_steals = 0;
+    //Most jobs ever in one of the worker's queues right after a push
+    uint64_t queue_high_water = 0;
+    //Time spent looking for jobs and time spent running them, only measured by worker threads
+    //as the thread that created the job system runs jobs from inside wait
+    uint64_t idle_ns = 0;
+    uint64_t busy_ns = 0;
+};
+
+/**
+ * Every worker's stats and their sum, the high water mark is the maximum instead of the sum
+ */
+struct JobSystemStats
+{
+    std::vector<WorkerStats> workers;
+    WorkerStats total;
+    //Jobs run by the blocking pool and the most threads it had at once, counted even with MJOB_STATS 0
+    uint64_t blocking_executed = 0;
+    uint32_t blocking_peak_threads = 0;
+};
+
+/**
+ * One executed job, timestamps come from read_timestamp
+ */
+struct TraceEvent
+{
+    uint64_t begin;
+    uint64_t end;
+    //The job's address, slots are reused so it only identifies the job within a short window
+    const Job* job;
+    const Job* parent;
+    //Worker whose queue the job was taken from, -1 for the injection queue
+    int32_t source;
+};
+
+/**
+ * Ring of the most recent trace events of one worker, written by the worker only.
+ * The storage is allocated up front so recording never allocates, the oldest events are overwritten
+ */
+class TraceBuffer
+{
+public:
+    static constexpr std::size_t capacity = 1u << 16;
+    static constexpr std::size_t mask = capacity - 1u;
+
+    TraceBuffer() :
+        m_events(trace_enabled ? new TraceEvent[capacity] : nullptr)
+    {}
+
+    //NOTE: Not threadsafe, must only be called from the owning worker's thread
+    void record(const TraceEvent& event)
+    {
+        const uint64_t count = m_count.load(std::memory_order_relaxed);
+        m_events[count & mask] = event;
+        m_count.store(count + 1u, std::memory_order_release);
+    }
 
     /**
-     * @brief wait Wait for the given job and all it's children to finish execution
-     * @param job
+     * @brief for_each Call fn(const TraceEvent&) for every event still in the ring, oldest first
+     * NOTE: Events may be overwritten meanwhile unless the worker is idle, such as after JobSystem::wait returned
+     * @param fn
      */
-    void wait(const Job* job)
+    template<typename Function>
+    void for_each(Function fn) const
     {
-        while(!has_job_completed(job))
+        const uint64_t count = m_count.load(std::memory_order_acquire);
+        for(uint64_t i=count > capacity ? count - capacity : 0; i < count; i++)
         {
-            m_workers[0]->fetch_and_execute();
+            fn(m_events[i & mask]);
         }
     }
 
 private:
+    std::unique_ptr<TraceEvent[]> m_events;
+    std::atomic<uint64_t> m_count{0};
+};
+
+/**
+ * Configures how a worker whose own queue is empty picks queues to steal from
+ */
+struct StealPolicy
+{
+    //Victims tried per call to get_job before the worker counts as idle
+    uint32_t attempts = 8;
+    //Move up to half of the victim's jobs into our own queue instead of taking a single job
+    bool steal_half = true;
+    //Locality group of every worker, such as the L3 cache or NUMA node it runs on.
+    //The first half of the attempts go to workers in the same group, empty means one group
+    std::vector<uint32_t> worker_groups;
+    //Physical core of every worker, workers sharing a core are tried before the rest of the group.
+    //The attempts are split evenly between same core, same group and any worker, empty means no shared cores
+    std::vector<uint32_t> worker_cores;
+};
+
+/**
+ * Configures where worker threads run
+ */
+struct AffinityPolicy
+{
+    //Pin every worker to it's own cpu, including worker 0 which is the thread creating the job system.
+    //That thread gets it's previous affinity back once the job system is destroyed.
+    //Also fills in StealPolicy::worker_groups and worker_cores from the topology unless already set
+    bool pin_threads = false;
+    //Where the cpu topology is read from, tests point this at a fake sysfs tree
+    std::string sysfs_root = "/sys/devices/system/cpu";
+};
+
+/**
+ * The cpus of the machine as the kernel reports them in sysfs
+ */
+class CpuTopology
+{
+public:
+    //The cpus a thread may run on, see get_current_affinity
+    struct Affinity
+    {
+#ifdef __linux__
+        cpu_set_t set;
+#endif
+        bool valid = false;
+    };
+
+    struct Cpu
+    {
+        uint32_t cpu;
+        //Unique per physical core, hyper threads of the same core share it
+        uint32_t core;
+        uint32_t package;
+        uint32_t node;
+    };
+
+    /**
+     * @brief load Read the online cpus and their core, package and NUMA node
+     * @param sysfs_root Usually /sys/devices/system/cpu
+     * @return false if the topology could not be read or is malformed
+     */
+    bool load(const std::string& sysfs_root)
+    {
+        m_cpus.clear();
+        m_core_ids.clear();
+        std::ifstream online(sysfs_root + "/online");
+        std::string ranges;
+        if(!(online >> ranges)) return false;
+        //A list of ranges such as 0-3,8-11
+        std::size_t pos = 0;
+        while(pos < ranges.size())
+        {
+            std::size_t end = ranges.find(',', pos);
+            if(end == std::string::npos) end = ranges.size();
+            const std::string range = ranges.substr(pos, end - pos);
+            const std::size_t dash = range.find('-');
+            uint32_t first;
+            uint32_t last;
+            if(!parse_number(range.substr(0, dash), first)) return false;
+            if(dash == std::string::npos) last = first;
+            else if(!parse_number(range.substr(dash + 1), last) || last < first) return false;
+            for(uint32_t cpu=first; cpu <= last; cpu++)
+            {
+                if(!load_cpu(sysfs_root, cpu)) return false;
+            }
+            pos = end + 1;
+        }
+        return !m_cpus.empty();
+    }
+
+    /**
+     * @brief placement Cpus in the order workers should take them, one cpu of every physical core first
+     * so hyper threads are only shared once every core is busy, grouped by node and package
+     * @return
+     */
+    std::vector<Cpu> placement() const
+    {
+        std::vector<std::pair<uint32_t, Cpu>> ranked;
+        for(const Cpu& cpu : m_cpus)
+        {
+            uint32_t sibling = 0;
+            for(const std::pair<uint32_t, Cpu>& other : ranked)
+            {
+                if(other.second.core == cpu.core) sibling++;
+            }
+            ranked.emplace_back(sibling, cpu);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<uint32_t, Cpu>& a, const std::pair<uint32_t, Cpu>& b)
+        {
+            if(a.first != b.first) return a.first < b.first;
+            if(a.second.node != b.second.node) return a.second.node < b.second.node;
+            if(a.second.package != b.second.package) return a.second.package < b.second.package;
+            return a.second.core < b.second.core;
+        });
+        std::vector<Cpu> cpus;
+        for(const std::pair<uint32_t, Cpu>& entry : ranked) cpus.push_back(entry.second);
+        return cpus;
+    }
+
+    const std::vector<Cpu>& cpus() const { return m_cpus; }
+
+    /**
+     * @brief pin_current_thread Pin the calling thread to a single cpu, does nothing on other platforms
+     * @param cpu
+     * @return false if the cpu could not be set
+     */
+    static bool pin_current_thread(uint32_t cpu)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief get_current_affinity Get the cpus the calling thread may run on, to restore them after pinning it
+     * @return Not valid if the affinity could not be read or on other platforms
+     */
+    static Affinity get_current_affinity()
+    {
+        Affinity affinity;
+#ifdef __linux__
+        affinity.valid = pthread_getaffinity_np(pthread_self(), sizeof(affinity.set), &affinity.set) == 0;
+#endif
+        return affinity;
+    }
+
+    /**
+     * @brief set_current_affinity Let the calling thread run on the cpus of affinity again
+     * @param affinity
+     * @return false if affinity is not valid or could not be set
+     */
+    static bool set_current_affinity(const Affinity& affinity)
+    {
+        if(!affinity.valid) return false;
+#ifdef __linux__
+        return pthread_setaffinity_np(pthread_self(), sizeof(affinity.set), &affinity.set) == 0;
+#else
+        return false;
+#endif
+    }
+
+private:
+    //Parses a whole string of decimal digits, unlike std::stoul nothing throws on odd sysfs contents
+    static bool parse_number(const std::string& text, uint32_t& value)
+    {
+        if(text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+        errno = 0;
+        char* end = nullptr;
+        const unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+        if(errno != 0 || *end != '\0' || parsed > std::numeric_limits<uint32_t>::max()) return false;
+        value = static_cast<uint32_t>(parsed);
+        return true;
+    }
+
+    static bool read_value(const std::string& path, uint32_t& value)
+    {
+        std::ifstream file(path);
+        return static_cast<bool>(file >> value);
+    }
+
+    bool load_cpu(const std::string& sysfs_root, uint32_t cpu)
+    {
+        const std::string dir = sysfs_root + "/cpu" + std::to_string(cpu);
+        uint32_t core_id;
+        uint32_t package;
+        if(!read_value(dir + "/topology/core_id", core_id) || !read_value(dir + "/topology/physical_package_id", package))
+        {
+            return false;
+        }
+        //The NUMA node shows up as a nodeN link in the cpu's directory, without NUMA the package is the node
+        uint32_t node = package;
+        std::error_code error;
+        //Incrementing with an error code, a range for would throw if the directory can not be read
+        for(std::filesystem::directory_iterator entry(dir, error); !error && entry != std::filesystem::directory_iterator();
+            entry.increment(error))
+        {
+            const std::string name = entry->path().filename().string();
+            if(name.compare(0, 4, "node") == 0 && parse_number(name.substr(4), node)) break;
+        }
+        //core_id is only unique within a package, hyper threads reuse the core of their first sibling
+        uint32_t core = static_cast<uint32_t>(m_cpus.size());
+        for(std::size_t i=0; i < m_cpus.size(); i++)
+        {
+            if(m_cpus[i].package == package && m_core_ids[i] == core_id)
+            {
+                core = m_cpus[i].core;
+                break;
+            }
+        }
+        m_cpus.push_back(Cpu{cpu, core, package, node});
+        m_core_ids.push_back(core_id);
+        return true;
+    }
+
+    std::vector<Cpu> m_cpus;
+    //core_id as read from sysfs for each entry of m_cpus
+    std::vector<uint32_t> m_core_ids;
+};
+
+/**
+ * Lets idle workers sleep until there is work, producers only pay for a fence
+ * and a load unless a worker is actually parked
+ */
+class EventCount
+{
+public:
+    /**
+     * @brief prepare_wait Announce that the caller is about to park, it must check for work
+     * once more after this and call either cancel_wait or wait
+     * @return key to pass to wait
+     */
+    uint64_t prepare_wait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        //Pairs with the fence in notify, the caller's re-check of the queues can not be ordered before the increment
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancel_wait() { m_waiters.fetch_sub(1, std::memory_order_seq_cst); }
+
+    /**
+     * @brief wait Park until notified after prepare_wait returned key
+     * @param key
+     */
+    void wait(uint64_t key)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [&]() { return m_epoch.load(std::memory_order_relaxed) != key; });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief wait_for Park until notified after prepare_wait returned key, or until timeout has passed
+     * @param key
+     * @param timeout
+     */
+    template<typename Rep, typename Period>
+    void wait_for(uint64_t key, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait_for(lock, timeout, [&]() { return m_epoch.load(std::memory_order_relaxed) != key; });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief has_waiters Check whether anyone is parked or about to park. A seq_cst RMW on the state
+     * a waiter checks, followed by this, is enough to never miss a waiter without an extra fence
+     * @return
+     */
+    bool has_waiters() const { return m_waiters.load(std::memory_order_seq_cst) != 0; }
+
+    /**
+     * @brief notify Wake up to count parked waiters, must be called after the work was published
+     * @param count
+     */
+    void notify(uint32_t count = 1)
+    {
+        //Orders the publishing of the work before reading the number of waiters
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const uint32_t waiters = m_waiters.load(std::memory_order_relaxed);
+        if(waiters == 0) return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(count >= waiters)
+        {
+            m_condition.notify_all();
+        }
+        else
+        {
+            for(uint32_t i=0; i < count; i++) m_condition.notify_one();
+        }
+    }
+
+    void notify_all() { notify(~0u); }
+
+private:
+    std::atomic<uint32_t> m_waiters{0};
+    std::atomic<uint64_t> m_epoch{0};
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+};
+
+/**
+ * @brief run_continuations Close the job's continuation list, hand the continuations to submit and release the slot
+ * @param job
+ * @param submit Called with every continuation
+ */
+template<typename Submit>
+inline void run_continuations(Job* job, Submit&& submit)
+{
+    uint32_t count = job->continuation_count.load(std::memory_order_acquire);
+    //Most jobs have no continuations and are released right away
+    while(!job->continuation_count.compare_exchange_weak(count, count == 0 ? continuations_released : count | continuations_closed,
+                                                         std::memory_order_acq_rel, std::memory_order_acquire))
+    {}
+    if(count == 0) return;
+    for(uint32_t i=0; i < count; i++)
+    {
+        //The slot is reserved before the continuation is stored, it may not be visible yet
+        Job* continuation;
+        while((continuation = job->continuations[i].load(std::memory_order_acquire)) == nullptr) cpu_relax();
+        job->continuations[i].store(nullptr, std::memory_order_relaxed);
+        submit(continuation);
+    }
+    job->continuation_count.store(continuations_released, std::memory_order_release);
+}
+
+/**
+ * @brief finish_job Count down the job after it ran, once it and all it's children are done its continuations
+ * are handed to submit, the parent is counted down and, when someone waits on this very job, the threads
+ * parked on completion_event are woken up. Jobs nobody waits on never touch the event
+ * @param job
+ * @param completion_event
+ * @param submit Called with every continuation
+ */
+template<typename Submit>
+inline void finish_job(Job* job, EventCount& completion_event, Submit&& submit)
+{
+    Job* parent = job->parent;
+    const uint32_t unfinished_jobs = --job->unfinished_jobs;
+    if(unfinished_jobs == 0)
+    {
+        //Read before the continuations are released, after that the slot may be handed out again.
+        //The decrement above is a seq_cst RMW and waiters register before checking the counter,
+        //so either they see the job completed or we see them
+        const bool waited = job->waiters.load(std::memory_order_seq_cst) != 0;
+        run_continuations(job, submit);
+        if(parent)
+        {
+            finish_job(parent, completion_event, submit);
+        }
+        if(waited && completion_event.has_waiters()) completion_event.notify_all();
+    }
+}
+
+/**
+ * Configures the pool running blocking jobs, see JobSystem::enqueue_blocking
+ */
+struct BlockingPolicy
+{
+    //Most blocking jobs running at once, further jobs wait for a thread to free up
+    uint32_t max_threads = 64;
+    //Threads idle for this long exit, the pool starts out without any
+    std::chrono::milliseconds keep_alive{1000};
+};
+
+/**
+ * Elastic pool of threads for jobs that block, such as file reads or waiting on a socket, so they never stall
+ * a worker and the jobs queued behind it. A thread is started whenever jobs arrive while every thread is busy,
+ * up to max_threads. Blocking jobs take long enough that a mutex around the queue costs nothing
+ */
+class BlockingPool
+{
+public:
+    //Hands a continuation of a finished job back to the job system
+    using Submit = void (*)(void* context, Job* job);
+
+    BlockingPool(EventCount* completion_event, Submit submit, void* submit_context, const BlockingPolicy& policy) :
+        m_completion_event(completion_event),
+        m_submit(submit),
+        m_submit_context(submit_context),
+        m_policy(policy)
+    {}
+
+    ~BlockingPool() { shutdown(); }
+
+    /**
+     * @brief push Queue a job and start a thread for it if every thread is busy, threadsafe
+     * @param job
+     */
+    void push(Job* job)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job);
+        if(m_jobs.size() > m_idle_threads && m_threads.size() - m_exited.size() < m_policy.max_threads)
+        {
+            reap_threads();
+            m_threads.emplace_back([this]() { thread_function(); });
+            m_peak_threads.store(std::max(m_peak_threads.load(std::memory_order_relaxed), static_cast<uint32_t>(m_threads.size())),
+                                 std::memory_order_relaxed);
+        }
+        else
+        {
+            m_condition.notify_one();
+        }
+    }
+
+    /**
+     * @brief shutdown Run the jobs still queued and join every thread, no job must be pushed after this
+     */
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        for(std::thread& thread : m_threads) thread.join();
+        m_threads.clear();
+        m_exited.clear();
+    }
+
+    //Blocking jobs run so far
+    uint64_t executed() const { return m_executed.load(std::memory_order_relaxed); }
+
+    //Most threads alive at the same time
+    uint32_t peak_threads() const { return m_peak_threads.load(std::memory_order_relaxed); }
+
+private:
+    void thread_function()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true)
+        {
+            if(m_jobs.empty())
+            {
+                if(m_stopping) break;
+                m_idle_threads++;
+                const bool woken = m_condition.wait_for(lock, m_policy.keep_alive,
+                                                        [this]() { return !m_jobs.empty() || m_stopping; });
+                m_idle_threads--;
+                if(!woken) break;
+                continue;
+            }
+            Job* job = m_jobs.front();
+            m_jobs.pop_front();
+            lock.unlock();
+
+            job->blocking = false;
+            job->pfn(job->payload);
+            //Counted before finishing, so it includes the job once a wait on it returns
+            m_executed.fetch_add(1, std::memory_order_relaxed);
+            //Continuations and the parent go back to the workers as if a worker finished the job
+            finish_job(job, *m_completion_event, [this](Job* continuation) { m_submit(m_submit_context, continuation); });
+
+            lock.lock();
+        }
+        //Joined by the next push or by shutdown
+        m_exited.push_back(std::this_thread::get_id());
+    }
+
+    //NOTE: m_mutex must be held
+    void reap_threads()
+    {
+        for(std::thread::id id : m_exited)
+        {
+            auto thread = std::find_if(m_threads.begin(), m_threads.end(),
+                                       [id](const std::thread& t) { return t.get_id() == id; });
+            thread->join();
+            m_threads.erase(thread);
+        }
+        m_exited.clear();
+    }
+
+    EventCount* m_completion_event;
+    Submit m_submit;
+    void* m_submit_context;
+    BlockingPolicy m_policy;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job*> m_jobs;
+    std::vector<std::thread> m_threads;
+    //Threads that left thread_function but were not joined yet
+    std::vector<std::thread::id> m_exited;
+    std::size_t m_idle_threads = 0;
+    bool m_stopping = false;
+    std::atomic<uint32_t> m_peak_threads{0};
+    std::atomic<uint64_t> m_executed{0};
+};
+
+/**
+ * One file read or write, see JobSystem::submit_read. Owned by the caller, it must stay alive until the job
+ * it was submitted for has finished
+ */
+struct IoRequest
+{
+    int fd = -1;
+    void* buffer = nullptr;
+    uint32_t size = 0;
+    uint64_t offset = 0;
+    //Bytes transferred or -errno, valid once the job it was submitted for has finished
+    int64_t result = 0;
+    //Counted down when the transfer completes, set on submission
+    Job* job = nullptr;
+};
+
+/**
+ * @brief transfer_blocking Do the transfer of request on the calling thread
+ * @param request
+ * @param write
+ * @return Bytes transferred or -errno
+ */
+inline int64_t transfer_blocking(const IoRequest& request, bool write)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    const ssize_t result = write ? ::pwrite(request.fd, request.buffer, request.size, static_cast<off_t>(request.offset))
+                                 : ::pread(request.fd, request.buffer, request.size, static_cast<off_t>(request.offset));
+    return result < 0 ? -errno : result;
+#else
+    (void)request;
+    (void)write;
+    return -ENOSYS;
+#endif
+}
+
+/**
+ * Configures how JobSystem::submit_read and submit_write transfer data
+ */
+struct IoPolicy
+{
+    //Use io_uring when the kernel supports it, otherwise every transfer runs as a job on the blocking pool
+    bool use_io_uring = true;
+    //Transfers in flight at once, submitting more helps out until one completes
+    uint32_t ring_entries = 256;
+};
+
+/**
+ * An io_uring instance shared by every thread. Submissions are serialized by a mutex, completions are reaped
+ * by whichever idle worker gets to them first, nobody ever blocks in the kernel waiting for one.
+ * At most as many transfers as the submission queue has entries are in flight, so the completion queue,
+ * which is twice as large, never overflows.
+ * Entries the kernel could not take yet stay queued and are handed over again by the next submit or poll,
+ * if the kernel rejects them outright their transfers complete with the error instead
+ */
+class IoRing
+{
+public:
+    IoRing() {}
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+    ~IoRing() { close(); }
+
+    /**
+     * @brief open Set up the ring
+     * NOTE: Not threadsafe, must be called before any other member
+     * @param entries Rounded up to a power of two by the kernel
+     * @return false if io_uring is not available, or does not support plain reads and writes
+     */
+    bool open(uint32_t entries)
+    {
+#if MJOB_IO_URING
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if(m_fd < 0) return false;
+
+        //IORING_OP_READ and WRITE are newer than io_uring itself
+        std::vector<unsigned char> probe_storage(sizeof(io_uring_probe) + 256u * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_storage.data());
+        if(::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+           probe->last_op < IORING_OP_WRITE || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+           !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+        {
+            close();
+            return false;
+        }
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = single_mmap ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = reinterpret_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+        if(!m_sq_ring || !m_cq_ring || !m_sqes)
+        {
+            close();
+            return false;
+        }
+
+        m_sq_head = reinterpret_cast<uint32_t*>(m_sq_ring + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<uint32_t*>(m_sq_ring + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<uint32_t*>(m_sq_ring + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<uint32_t*>(m_sq_ring + params.sq_off.array);
+        m_cq_head = reinterpret_cast<uint32_t*>(m_cq_ring + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<uint32_t*>(m_cq_ring + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<uint32_t*>(m_cq_ring + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(m_cq_ring + params.cq_off.cqes);
+        m_capacity = params.sq_entries;
+        return true;
+#else
+        (void)entries;
+        return false;
+#endif
+    }
+
+    bool is_open() const { return m_capacity != 0; }
+
+    //Transfers submitted but not reaped yet
+    uint32_t in_flight() const { return m_in_flight.load(std::memory_order_acquire); }
+
+    /**
+     * @brief submit Start the transfer, threadsafe
+     * @param request
+     * @param write
+     * @return false if the ring is full, nothing was submitted
+     */
+    bool submit(IoRequest* request, bool write)
+    {
+#if MJOB_IO_URING
+        std::lock_guard<std::mutex> lock(m_submit_mutex);
+        if(m_in_flight.load(std::memory_order_relaxed) >= m_capacity) return false;
+        //We are the only writer of the tail, the kernel advances the head
+        const uint32_t tail = *m_sq_tail;
+        const uint32_t index = tail & m_sq_mask;
+        io_uring_sqe& sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = request->fd;
+        sqe.addr = reinterpret_cast<uint64_t>(request->buffer);
+        sqe.len = request->size;
+        sqe.off = request->offset;
+        sqe.user_data = reinterpret_cast<uint64_t>(request);
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1u, __ATOMIC_RELEASE);
+        m_in_flight.fetch_add(1, std::memory_order_acq_rel);
+        flush();
+        return true;
+#else
+        (void)request;
+        (void)write;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief poll Reap completed transfers without blocking, threadsafe. Only one thread reaps at a time,
+     * the others return right away
+     * @param complete Called with every completed request, it's result already filled in
+     * @return Number of completed requests
+     */
+    template<typename Complete>
+    uint32_t poll(Complete&& complete)
+    {
+        uint32_t completed = 0;
+#if MJOB_IO_URING
+        if(in_flight() == 0 || m_polling.exchange(true, std::memory_order_acquire)) return 0;
+        uint32_t head = *m_cq_head;
+        const uint32_t tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+            IoRequest* request = reinterpret_cast<IoRequest*>(cqe.user_data);
+            request->result = cqe.res;
+            //Hand the entry back before the request may be reused
+            __atomic_store_n(m_cq_head, head + 1u, __ATOMIC_RELEASE);
+            m_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+            complete(request);
+            completed++;
+        }
+        //Retry entries the kernel had no room for, and complete those it rejected
+        if(m_needs_flush.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(m_submit_mutex, std::try_to_lock);
+            if(lock.owns_lock())
+            {
+                flush();
+                m_failed.swap(m_failed_reaped);
+                lock.unlock();
+                for(IoRequest* request : m_failed_reaped)
+                {
+                    m_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+                    complete(request);
+                    completed++;
+                }
+                m_failed_reaped.clear();
+            }
+        }
+        m_polling.store(false, std::memory_order_release);
+#else
+        (void)complete;
+#endif
+        return completed;
+    }
+
+private:
+#if MJOB_IO_URING
+    /**
+     * @brief flush Hand every queued entry to the kernel, retrying interrupted and partial submits.
+     * When the kernel is out of resources the entries stay queued for a later flush, when it fails otherwise
+     * they are taken back and their requests completed with the error by the next poll
+     * NOTE: m_submit_mutex must be held
+     */
+    void flush()
+    {
+        bool needs_flush = false;
+        for(;;)
+        {
+            const uint32_t head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+            const uint32_t tail = *m_sq_tail;
+            if(head == tail) break;
+            const long submitted = ::syscall(__NR_io_uring_enter, m_fd, tail - head, 0, 0, nullptr, 0);
+            if(submitted > 0) continue;
+            if(submitted < 0 && errno == EINTR) continue;
+            if(submitted == 0 || errno == EAGAIN || errno == EBUSY)
+            {
+                needs_flush = true;
+                break;
+            }
+            //Without SQPOLL the kernel only reads the tail during the call, a failed call took nothing
+            const int64_t error = -errno;
+            for(uint32_t i=head; i != tail; i++)
+            {
+                IoRequest* request = reinterpret_cast<IoRequest*>(m_sqes[i & m_sq_mask].user_data);
+                request->result = error;
+                m_failed.push_back(request);
+            }
+            __atomic_store_n(m_sq_tail, head, __ATOMIC_RELEASE);
+            break;
+        }
+        m_needs_flush.store(needs_flush || !m_failed.empty(), std::memory_order_release);
+    }
+
+    unsigned char* map(std::size_t size, uint64_t offset)
+    {
+        void* memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, static_cast<off_t>(offset));
+        return memory == MAP_FAILED ? nullptr : static_cast<unsigned char*>(memory);
+    }
+#endif
+
+    void close()
+    {
+#if MJOB_IO_URING
+        if(m_sqes) ::munmap(m_sqes, m_sqes_size);
+        if(m_cq_ring && m_cq_ring != m_sq_ring) ::munmap(m_cq_ring, m_cq_ring_size);
+        if(m_sq_ring) ::munmap(m_sq_ring, m_sq_ring_size);
+        if(m_fd >= 0) ::close(m_fd);
+        m_sqes = nullptr;
+        m_cq_ring = m_sq_ring = nullptr;
+        m_fd = -1;
+        m_capacity = 0;
+#endif
+    }
+
+    int m_fd = -1;
+    uint32_t m_capacity = 0;
+#if MJOB_IO_URING
+    unsigned char* m_sq_ring = nullptr;
+    unsigned char* m_cq_ring = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    std::size_t m_sq_ring_size = 0;
+    std::size_t m_cq_ring_size = 0;
+    std::size_t m_sqes_size = 0;
+    uint32_t* m_sq_head = nullptr;
+    uint32_t* m_sq_tail = nullptr;
+    uint32_t* m_sq_array = nullptr;
+    uint32_t m_sq_mask = 0;
+    uint32_t* m_cq_head = nullptr;
+    uint32_t* m_cq_tail = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+    uint32_t m_cq_mask = 0;
+#endif
+    std::mutex m_submit_mutex;
+    //Requests the kernel rejected, completed by poll. Guarded by m_submit_mutex
+    std::vector<IoRequest*> m_failed;
+    //Only touched by the thread polling
+    std::vector<IoRequest*> m_failed_reaped;
+    alignas(cache_line_size) std::atomic<uint32_t> m_in_flight{0};
+    std::atomic<bool> m_polling{false};
+    //Set while entries wait to be handed over again or failed requests wait to be completed
+    std::atomic<bool> m_needs_flush{false};
+};
+
+/**
+ * Jobs waiting for a point in time, see JobSystem::enqueue_at. A hierarchical timing wheel of four levels of 64 slots,
+ * the slots of level 0 are one tick wide and every level's slots are 64 times as wide as those of the level below.
+ * Whenever level 0 wraps around the next slot of level 1 is spread over level 0, and so on up, so inserting and
+ * expiring a job take constant time however many are waiting. Deadlines past the last level wait in it's furthest
+ * slot and are placed again when that slot comes around.
+ * There is no timer thread, idle workers call service. A mutex guards the wheel, servicing only tries to lock it
+ */
+class TimerWheel
+{
+public:
+    //Resolution of the wheel, a job never runs before it's deadline and at most one tick is lost rounding up
+    static constexpr int64_t tick_ns = 16384;
+    static constexpr uint32_t levels = 4u;
+    static constexpr uint32_t slot_bits = 6u;
+    static constexpr uint32_t slots = 1u << slot_bits;
+    static constexpr uint64_t slot_mask = slots - 1u;
+
+    TimerWheel() : m_start(std::chrono::steady_clock::now()) {}
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * @brief insert Hold job until deadline, threadsafe
+     * @param job
+     * @param deadline
+     * @return false if the deadline has passed, the job was not inserted
+     */
+    bool insert(Job* job, std::chrono::steady_clock::time_point deadline)
+    {
+        const int64_t deadline_ns = to_ns(deadline);
+        const uint64_t deadline_tick = deadline_ns <= 0 ? 0u : static_cast<uint64_t>((deadline_ns + tick_ns - 1) / tick_ns);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(deadline_tick <= m_current_tick) return false;
+        place(Entry{deadline_tick, job});
+        m_pending.store(m_pending.load(std::memory_order_relaxed) + 1u, std::memory_order_release);
+        update_next_check();
+        return true;
+    }
+
+    //Jobs waiting for their deadline
+    uint32_t pending() const { return m_pending.load(std::memory_order_acquire); }
+
+    /**
+     * @brief ns_until_next How long until service may have something to expire, never later than the next deadline
+     * @return INT64_MAX when no job is waiting, zero or less when service should be called now
+     */
+    int64_t ns_until_next() const
+    {
+        if(pending() == 0) return std::numeric_limits<int64_t>::max();
+        return m_next_check_ns.load(std::memory_order_acquire) - to_ns(std::chrono::steady_clock::now());
+    }
+
+    /**
+     * @brief service Expire every job whose deadline has passed, threadsafe. Only one thread services at a time,
+     * the others return right away. Cheap when nothing is due, a clock read and two loads
+     * @param expire Called with every expired job while the wheel is locked, it must not call back into the wheel
+     * @return Number of expired jobs
+     */
+    template<typename Expire>
+    uint32_t service(Expire&& expire)
+    {
+        if(ns_until_next() > 0) return 0;
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        if(!lock.owns_lock()) return 0;
+        const uint64_t now_tick = static_cast<uint64_t>(std::max<int64_t>(0, to_ns(std::chrono::steady_clock::now())) / tick_ns);
+        const uint32_t expired = advance(now_tick, expire);
+        update_next_check();
+        return expired;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t deadline_tick;
+        Job* job;
+    };
+
+    int64_t to_ns(std::chrono::steady_clock::time_point time) const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_start).count();
+    }
+
+    /**
+     * @brief place Put the entry in the lowest level whose span reaches it's deadline, relative to the current tick.
+     * An entry due at the current tick goes into the level 0 slot about to be expired
+     * @param entry
+     */
+    void place(const Entry& entry)
+    {
+        const uint64_t delta = entry.deadline_tick - m_current_tick;
+        uint32_t level = 0;
+        while(level + 1u < levels && delta >= (uint64_t(1) << (slot_bits * (level + 1u)))) level++;
+        uint64_t tick = entry.deadline_tick;
+        //Too far out for the last level, wait in it's furthest slot
+        if(delta >= (uint64_t(1) << (slot_bits * levels))) tick = m_current_tick + (uint64_t(1) << (slot_bits * levels)) - 1u;
+        const uint32_t index = static_cast<uint32_t>((tick >> (slot_bits * level)) & slot_mask);
+        m_slots[level][index].push_back(entry);
+        m_occupied[level] |= uint64_t(1) << index;
+    }
+
+    /**
+     * @brief advance Step the current tick up to now_tick, cascading and expiring slots on the way.
+     * While level 0 is empty it jumps straight to the next wrap around
+     * @param now_tick
+     * @param expire
+     * @return Number of expired jobs
+     */
+    template<typename Expire>
+    uint32_t advance(uint64_t now_tick, Expire& expire)
+    {
+        uint32_t expired = 0;
+        while(m_current_tick < now_tick)
+        {
+            if(m_pending.load(std::memory_order_relaxed) == 0)
+            {
+                m_current_tick = now_tick;
+                break;
+            }
+            if(m_occupied[0] == 0)
+            {
+                const uint64_t next_wrap = (m_current_tick | slot_mask) + 1u;
+                if(next_wrap > now_tick)
+                {
+                    m_current_tick = now_tick;
+                    break;
+                }
+                m_current_tick = next_wrap;
+            }
+            else
+            {
+                m_current_tick++;
+            }
+
+            const uint64_t tick = m_current_tick;
+            //A level cascades when every level below it wrapped around
+            for(uint32_t level=1; level < levels && ((tick >> (slot_bits * (level - 1u))) & slot_mask) == 0; level++)
+            {
+                const uint32_t index = static_cast<uint32_t>((tick >> (slot_bits * level)) & slot_mask);
+                if(!(m_occupied[level] & (uint64_t(1) << index))) continue;
+                take_slot(level, index);
+                for(const Entry& entry : m_scratch) place(entry);
+            }
+
+            const uint32_t index = static_cast<uint32_t>(tick & slot_mask);
+            if(!(m_occupied[0] & (uint64_t(1) << index))) continue;
+            take_slot(0, index);
+            m_pending.store(m_pending.load(std::memory_order_relaxed) - static_cast<uint32_t>(m_scratch.size()),
+                            std::memory_order_release);
+            for(const Entry& entry : m_scratch) expire(entry.job);
+            expired += static_cast<uint32_t>(m_scratch.size());
+        }
+        return expired;
+    }
+
+    //Move the slot's entries into m_scratch, the slot keeps the scratch's capacity
+    void take_slot(uint32_t level, uint32_t index)
+    {
+        m_scratch.clear();
+        m_scratch.swap(m_slots[level][index]);
+        m_occupied[level] &= ~(uint64_t(1) << index);
+    }
+
+    //The next tick advance has anything to do at, the next occupied slot of level 0 or the next cascade
+    void update_next_check()
+    {
+        if(m_pending.load(std::memory_order_relaxed) == 0)
+        {
+            m_next_check_ns.store(std::numeric_limits<int64_t>::max(), std::memory_order_release);
+            return;
+        }
+        uint64_t next_tick = std::numeric_limits<uint64_t>::max();
+        for(uint64_t distance=1; distance < slots; distance++)
+        {
+            if(m_occupied[0] & (uint64_t(1) << ((m_current_tick + distance) & slot_mask)))
+            {
+                next_tick = m_current_tick + distance;
+                break;
+            }
+        }
+        for(uint32_t level=1; level < levels; level++)
+        {
+            if(m_occupied[level] != 0)
+            {
+                next_tick = std::min(next_tick, (m_current_tick | slot_mask) + 1u);
+                break;
+            }
+        }
+        m_next_check_ns.store(static_cast<int64_t>(next_tick) * tick_ns, std::memory_order_release);
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    std::mutex m_mutex;
+    uint64_t m_current_tick = 0;
+    uint64_t m_occupied[levels] = {};
+    std::vector<Entry> m_slots[levels][slots];
+    std::vector<Entry> m_scratch;
+    //Read by idle workers without the lock
+    alignas(cache_line_size) std::atomic<uint32_t> m_pending{0};
+    std::atomic<int64_t> m_next_check_ns{std::numeric_limits<int64_t>::max()};
+};
+
+/**
+ * What a thread does while waiting for a job to finish
+ */
+enum class WaitMode
+{
+    //Run any job while waiting, gets the most work done but an unrelated long job can delay the return
+    help_any,
+    //Only run jobs from the awaited job's subtree that sit at the bottom of our own queue
+    help_related,
+    //Never run jobs, sleep until the awaited job completes
+    park,
+};
+
+class JobSystem;
+
+/**
+ * Each worker owns it's deque and allocator inline, aligned so no two workers share a cache line
+ */
+class alignas(cache_line_size) JobWorker
+{
+public:
+    JobWorker(JobSystem* system, uint8_t worker_idx, uint8_t num_workers, WorkStealingQueue<>** queues,
+              InjectionQueue<>* injection_queues, EventCount* idle_event, EventCount* completion_event,
+              BlockingPool* blocking_pool, IoRing* io_ring, TimerWheel* timers, const IdlePolicy& idle_policy,
+              const StealPolicy& steal_policy) :
+        m_system(system),
+        m_worker_idx(worker_idx),
+        m_num_workers(num_workers),
+        m_queues(queues),
+        m_injection_queues(injection_queues),
+        m_idle_event(idle_event),
+        m_completion_event(completion_event),
+        m_blocking_pool(blocking_pool),
+        m_io_ring(io_ring),
+        m_timers(timers),
+        m_idle_policy(idle_policy),
+        m_steal_attempts(steal_policy.attempts),
+        m_steal_half(steal_policy.steal_half),
+        //Any non zero seed works for xorshift, keep the workers' sequences apart
+        m_random(0x9E3779B9u * (worker_idx + 1u))
+    {
+        set_steal_group(steal_policy.worker_groups, steal_policy.worker_cores);
+    }
+
+    /**
+     * @brief set_steal_group Set the workers preferred as steal victims, first those on the same core as this one,
+     * then those in the same group
+     * NOTE: Not threadsafe, must be called before the worker is started
+     * @param worker_groups Group of every worker, empty means one group
+     * @param worker_cores Core of every worker, empty means no shared cores
+     */
+    void set_steal_group(const std::vector<uint32_t>& worker_groups,
+                         const std::vector<uint32_t>& worker_cores = std::vector<uint32_t>())
+    {
+        m_victim_tiers.clear();
+        const bool has_cores = worker_cores.size() == m_num_workers;
+        const bool has_groups = worker_groups.size() == m_num_workers;
+        std::vector<uint32_t> same_core;
+        std::vector<uint32_t> same_group;
+        for(uint32_t i=0; i < m_num_workers; i++)
+        {
+            if(i == m_worker_idx) continue;
+            if(has_cores && worker_cores[i] == worker_cores[m_worker_idx]) same_core.push_back(i);
+            else if(has_groups && worker_groups[i] == worker_groups[m_worker_idx]) same_group.push_back(i);
+        }
+        //A tier holding everyone is no better than picking any worker
+        for(std::vector<uint32_t>* tier : {&same_core, &same_group})
+        {
+            if(!tier->empty() && tier->size() + 1u < m_num_workers) m_victim_tiers.push_back(std::move(*tier));
+        }
+    }
+
+    ~JobWorker() {}
+
+    void set_active(bool active) { m_active.store(active, std::memory_order_release); }
+    bool is_active() const { return m_active.load(std::memory_order_acquire); }
+    bool is_empty_job(Job* job) { return job == nullptr; }
+
+    //NOTE: Not threadsafe, must be called from worker threads thread
+    void run(Job* job)
+    {
+        if(job->blocking)
+        {
+            m_blocking_pool->push(job);
+            return;
+        }
+        WorkStealingQueue<>* queue = get_queue(job->priority);
+        queue->push(job);
+        if constexpr(stats_enabled) m_counters.queue_high_water.raise_to(queue->size());
+        m_idle_event->notify();
+    }
+
+    /**
+     * @brief run_batch Push count jobs onto our queues, one publish per run of jobs with the same priority,
+     * and wake up as many sleeping workers as there are jobs for
+     * NOTE: Not threadsafe, must be called from worker threads thread
+     * @param jobs
+     * @param count
+     */
+    void run_batch(Job* const* jobs, std::size_t count)
+    {
+        for(std::size_t begin=0, end=0; begin < count; begin=end)
+        {
+            const JobPriority priority = jobs[begin]->priority;
+            for(end=begin + 1u; end < count && jobs[end]->priority == priority; end++) {}
+            WorkStealingQueue<>* queue = get_queue(priority);
+            queue->push_batch(jobs + begin, end - begin);
+            if constexpr(stats_enabled) m_counters.queue_high_water.raise_to(queue->size());
+        }
+        //We take one of the jobs ourselves
+        m_idle_event->notify(static_cast<uint32_t>(std::min<std::size_t>(count, m_num_workers - 1u)));
+    }
+
+    /**
+     * @brief get_queue Get this worker's queue for the given priority
+     * @param priority
+     * @return
+     */
+    WorkStealingQueue<>* get_queue(JobPriority priority = JobPriority::normal)
+    {
+        return &m_queues_by_priority[static_cast<std::size_t>(priority)];
+    }
+
+    /**
+     * @brief get_worker_idx Get the index of this worker, worker 0 belongs to the thread that created the job system
+     * @return
+     */
+    uint8_t get_worker_idx() const { return m_worker_idx; }
+
+    /**
+     * @brief get_allocator Get the job allocator owned by this worker
+     * NOTE: Not threadsafe, must only be used from this worker's thread
+     * @return
+     */
+    JobAllocator& get_allocator() { return m_allocator; }
+
+    /**
+     * @brief get_stats Threadsafe, the counters are updated without synchronization so the snapshot
+     * may be slightly behind
+     * @return
+     */
+    WorkerStats get_stats() const
+    {
+        WorkerStats stats;
+        stats.executed = m_counters.executed.get();
+        stats.stolen = m_counters.stolen.get();
+        stats.failed_steals = m_counters.failed_steals.get();
+        stats.queue_high_water = m_counters.queue_high_water.get();
+        stats.idle_ns = m_counters.idle_ns.get();
+        stats.busy_ns = m_counters.busy_ns.get();
+        return stats;
+    }
+
+    /**
+     * @brief set_tracing Start or stop recording executed jobs, has no effect unless compiled with MJOB_TRACE 1
+     * @param tracing
+     */
+    void set_tracing(bool tracing) { m_tracing.store(tracing, std::memory_order_relaxed); }
+
+    const TraceBuffer& get_trace() const { return m_trace; }
+
+    /**
+     * @brief get_system Get the job system this worker belongs to
+     * @return
+     */
+    JobSystem* get_system() const { return m_system; }
+
+    /**
+     * @brief current Get the worker bound to the calling thread
+     * @return nullptr if the calling thread has no worker bound
+     */
+    static JobWorker* current() { return current_slot(); }
+
+    /**
+     * @brief bind_to_current_thread Make this the worker returned by current() on the calling thread
+     */
+    void bind_to_current_thread() { current_slot() = this; }
+
+    /**
+     * @brief unbind_current_thread Clear current() on the calling thread if this worker is bound to it
+     */
+    void unbind_current_thread()
+    {
+        if(current_slot() == this) current_slot() = nullptr;
+    }
+
+    /**
+     * @brief get_thread Get the thread associated with this worker
+     * @return
+     */
+    std::thread& get_thread() { return m_thread; }
+
+    /**
+     * @brief set_thread Set the thread assocciated with this worker
+     * @param thread
+     */
+    void set_thread(std::thread&& thread) { m_thread = std::move(thread); }
+
+    /**
+     * @brief thread_function Main loop, goes idle according to the idle policy if there is no job available
+     */
+    void thread_function()
+    {
+        bind_to_current_thread();
+        uint32_t idle_rounds = 0;
+        //The clock is only read when switching between running jobs and looking for them
+        int64_t switched_at_ns = stats_enabled ? clock_ns() : 0;
+        while(is_active())
+        {
+            if(Job* job = get_job())
+            {
+                if constexpr(stats_enabled)
+                {
+                    if(idle_rounds != 0) switched_at_ns = add_elapsed_ns(m_counters.idle_ns, switched_at_ns);
+                }
+                execute_job(job);
+                idle_rounds = 0;
+            }
+            else
+            {
+                if constexpr(stats_enabled)
+                {
+                    if(idle_rounds == 0) switched_at_ns = add_elapsed_ns(m_counters.busy_ns, switched_at_ns);
+                }
+                idle(idle_rounds++);
+            }
+        }
+        if constexpr(stats_enabled) add_elapsed_ns(idle_rounds == 0 ? m_counters.busy_ns : m_counters.idle_ns, switched_at_ns);
+    }
+
+
+    /**
+     * @brief fetch_and_execute Attempt to fetch and execute a job, yields if there is no job available
+     */
+    void fetch_and_execute()
+    {
+        if(!try_execute()) std::this_thread::yield();
+    }
+
+    /**
+     * @brief try_execute Attempt to fetch and execute a job
+     * @return false if there was no job available
+     */
+    bool try_execute()
+    {
+        Job* job = get_job();
+        if(is_empty_job(job)) return false;
+        execute_job(job);
+        return true;
+    }
+
+    /**
+     * @brief try_execute_if Execute the first job at the bottom of our own queues that satisfies predicate,
+     * it is left in place otherwise. Does not look at the injection queue or steal
+     * @param predicate Callable as predicate(const Job*)
+     * @return false if no job was executed
+     */
+    template<typename Predicate>
+    bool try_execute_if(Predicate predicate)
+    {
+        for(WorkStealingQueue<>& queue : m_queues_by_priority)
+        {
+            Job* job = queue.pop();
+            if(is_empty_job(job)) continue;
+            if(!predicate(static_cast<const Job*>(job)))
+            {
+                queue.push(job);
+                continue;
+            }
+            execute_job(job);
+            return true;
+        }
+        return false;
+    }
+private:
+
+    /**
+     * @brief idle Called after idle_rounds failed attempts in a row to get a job
+     * @param idle_rounds
+     */
+    void idle(uint32_t idle_rounds)
+    {
+        if(idle_rounds < m_idle_policy.spin_count)
+        {
+            cpu_relax();
+        }
+        else if(idle_rounds < m_idle_policy.spin_count + m_idle_policy.yield_count || !m_idle_policy.park)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            park();
+        }
+    }
+
+    /**
+     * @brief park Sleep until a job is enqueued, the worker is deactivated or the next timer is close
+     */
+    void park()
+    {
+        const uint64_t key = m_idle_event->prepare_wait();
+        //A job may have been published before we announced ourselves as a waiter
+        if(has_pending_jobs() || !is_active())
+        {
+            m_idle_event->cancel_wait();
+            return;
+        }
+        //Sleeping takes longer than asked for, stay up for a deadline that is close
+        const int64_t until_timer_ns = m_timers->ns_until_next();
+        if(until_timer_ns < timer_wake_early.count())
+        {
+            m_idle_event->cancel_wait();
+            std::this_thread::yield();
+            return;
+        }
+        //Completed transfers and due timers do not wake us, come back for them in time
+        std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max();
+        if(m_io_ring->in_flight() != 0) timeout = io_poll_interval;
+        if(until_timer_ns != std::numeric_limits<int64_t>::max())
+        {
+            timeout = std::min(timeout, std::chrono::nanoseconds(until_timer_ns) - timer_wake_early);
+        }
+        if(timeout != std::chrono::nanoseconds::max()) m_idle_event->wait_for(key, timeout);
+        else m_idle_event->wait(key);
+    }
+
+    /**
+     * @brief has_pending_jobs Check whether there is any job this worker could get
+     * @return
+     */
+    bool has_pending_jobs() const
+    {
+        for(std::size_t p=0; p < num_priorities; p++)
+        {
+            if(!m_injection_queues[p].is_empty()) return true;
+        }
+        for(uint32_t i=0; i < m_num_workers * num_priorities; i++)
+        {
+            if(!m_queues[i]->is_empty()) return true;
+        }
+        return false;
+    }
+
+    static int64_t clock_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief add_elapsed_ns Add the time since since_ns to counter
+     * @param counter
+     * @param since_ns
+     * @return Now
+     */
+    static int64_t add_elapsed_ns(StatCounter& counter, int64_t since_ns)
+    {
+        const int64_t now = clock_ns();
+        counter.add(static_cast<uint64_t>(now - since_ns));
+        return now;
+    }
+
+    static JobWorker*& current_slot()
+    {
+        static thread_local JobWorker* worker = nullptr;
+        return worker;
+    }
+
+    /**
+     * @brief execute_job
+     * @param job
+     */
+    void execute_job(Job* job)
+    {
+        if constexpr(trace_enabled)
+        {
+            if(m_tracing.load(std::memory_order_relaxed))
+            {
+                //The slot may be reused as soon as the job finished, read everything up front
+                TraceEvent event{read_timestamp(), 0, job, job->parent, m_job_source};
+                job->pfn(job->payload);
+                finish(job);
+                event.end = read_timestamp();
+                m_trace.record(event);
+                if constexpr(stats_enabled) m_counters.executed.add(1);
+                return;
+            }
+        }
+        job->pfn(job->payload);
+        finish(job);
+        if constexpr(stats_enabled) m_counters.executed.add(1);
+    }
+
+    /**
+     * @brief get_job Get the most important job available, when there is none reap completed transfers,
+     * expire due timers and look again
+     * @return
+     */
+    Job* get_job()
+    {
+        Job* job = get_queued_job();
+        //Nothing to run, reap finished transfers and due timers as they may have made jobs ready
+        if(is_empty_job(job) && poll_io() + poll_timers() != 0) job = get_queued_job();
+        return job;
+    }
+
+    /**
+     * @brief poll_io Finish the jobs waiting on transfers that have completed, their continuations go onto our queues
+     * @return Number of completed transfers
+     */
+    uint32_t poll_io()
+    {
+        if(!m_io_ring->is_open()) return 0;
+        return m_io_ring->poll([this](IoRequest* request) { finish(request->job); });
+    }
+
+    /**
+     * @brief poll_timers Enqueue the jobs whose deadline has passed onto our queues
+     * @return Number of expired jobs
+     */
+    uint32_t poll_timers()
+    {
+        return m_timers->service([this](Job* job) { run(job); });
+    }
+
+    /**
+     * @brief get_queued_job Get the most important job available, every starvation_interval calls
+     * the priorities are checked lowest first instead. Our own and the injection queues of every priority
+     * are checked before stealing from anyone
+     * @return
+     */
+    Job* get_queued_job()
+    {
+        const bool lowest_first = ++m_get_job_calls % starvation_interval == 0;
+        //Local work of any priority comes before stealing, a failed steal probes other workers' cache lines
+        for(std::size_t i=0; i < num_priorities; i++)
+        {
+            const JobPriority priority = static_cast<JobPriority>(lowest_first ? num_priorities - 1u - i : i);
+            if(Job* job = get_local_job(priority)) return job;
+        }
+        for(std::size_t i=0; i < num_priorities; i++)
+        {
+            const JobPriority priority = static_cast<JobPriority>(lowest_first ? num_priorities - 1u - i : i);
+            if(Job* job = steal_job(priority)) return job;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief get_local_job Get a job of the given priority from our own queue or the injection queue
+     * @param priority
+     * @return
+     */
+    Job* get_local_job(JobPriority priority)
+    {
+        Job* job = get_queue(priority)->pop();
+        if(!is_empty_job(job))
+        {
+            if constexpr(trace_enabled) m_job_source = m_worker_idx;
+            return job;
+        }
+        //Jobs submitted from outside the worker threads
+        job = m_injection_queues[static_cast<std::size_t>(priority)].pop();
+        if(!is_empty_job(job))
+        {
+            if constexpr(trace_enabled) m_job_source = -1;
+        }
+        return job;
+    }
+
+    /**
+     * @brief steal_job Try up to the steal policy's number of randomly picked victims
+     * @param priority
+     * @return
+     */
+    Job* steal_job(JobPriority priority)
+    {
+        if(m_num_workers == 1) return nullptr;
+        for(uint32_t attempt=0; attempt < m_steal_attempts; attempt++)
+        {
+            //The attempts are split evenly between the near tiers and any worker, nearest first
+            const std::size_t tier = attempt * (m_victim_tiers.size() + 1u) / m_steal_attempts;
+            uint32_t victim;
+            if(tier < m_victim_tiers.size())
+            {
+                const std::vector<uint32_t>& victims = m_victim_tiers[tier];
+                victim = victims[random_below(static_cast<uint32_t>(victims.size()))];
+            }
+            else
+            {
+                //Any worker but ourselves
+                victim = random_below(m_num_workers - 1u);
+                if(victim >= m_worker_idx) victim++;
+            }
+            WorkStealingQueue<>* queue = m_queues[victim * num_priorities + static_cast<std::size_t>(priority)];
+            Job* job = m_steal_half ? steal_half(queue, priority) : queue->steal();
+            if(!is_empty_job(job))
+            {
+                if constexpr(stats_enabled) m_counters.stolen.add(1);
+                if constexpr(trace_enabled) m_job_source = static_cast<int32_t>(victim);
+                return job;
+            }
+            if constexpr(stats_enabled) m_counters.failed_steals.add(1);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief steal_half Steal one job to run and move up to half of the victim's remaining jobs
+     * into our own queue. Chase-Lev only allows stealing one job per CAS, taking a range at once would race
+     * with the owner's pop, so this is a run of single steals from the same victim
+     * @param victim
+     * @param priority Priority of the victim queue, moved jobs go into our own queue of the same priority
+     * @return
+     */
+    Job* steal_half(WorkStealingQueue<>* victim, JobPriority priority)
+    {
+        Job* job = victim->steal();
+        if(is_empty_job(job)) return nullptr;
+        const std::size_t extra = victim->size() / 2u;
+        uint32_t moved = 0;
+        for(std::size_t i=0; i < extra; i++)
+        {
+            Job* stolen_job = victim->steal();
+            if(is_empty_job(stolen_job)) break;
+            get_queue(priority)->push(stolen_job);
+            moved++;
+        }
+        if(moved != 0)
+        {
+            if constexpr(stats_enabled)
+            {
+                m_counters.stolen.add(moved);
+                m_counters.queue_high_water.raise_to(get_queue(priority)->size());
+            }
+            m_idle_event->notify(moved);
+        }
+        return job;
+    }
+
+    /**
+     * @brief random_below xorshift32, mapped to [0, n) without a division
+     * @param n
+     * @return
+     */
+    uint32_t random_below(uint32_t n)
+    {
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        return static_cast<uint32_t>((static_cast<uint64_t>(m_random) * n) >> 32);
+    }
+
+    /**
+     * @brief finish
+     * @param job
+     */
+    void finish(Job* job)
+    {
+        //Continuations run on this worker
+        finish_job(job, *m_completion_event, [this](Job* continuation) { run(continuation); });
+    }
+
+    std::atomic<bool> m_active{false};
+    JobSystem* m_system;
+    uint8_t m_worker_idx;
+    uint8_t m_num_workers;
+    //Every worker's queues, num_priorities per worker
+    WorkStealingQueue<>** m_queues;
+    InjectionQueue<>* m_injection_queues;
+    EventCount* m_idle_event;
+    EventCount* m_completion_event;
+    BlockingPool* m_blocking_pool;
+    IoRing* m_io_ring;
+    TimerWheel* m_timers;
+    IdlePolicy m_idle_policy;
+
+    std::thread m_thread;
+    uint32_t m_steal_attempts;
+    bool m_steal_half;
+    uint32_t m_random;
+    //Workers on the same core, then in the same group, each tier only when non empty
+    std::vector<std::vector<uint32_t>> m_victim_tiers;
+
+    //Every this many calls to get_job lower priorities are checked first
+    static constexpr uint32_t starvation_interval = 32u;
+    //How long a parked worker sleeps before reaping transfers again
+    static constexpr std::chrono::microseconds io_poll_interval{50};
+    //How long before a deadline a parked worker wakes up, then it yields until the timer is due
+    static constexpr std::chrono::microseconds timer_wake_early{200};
+    uint32_t m_get_job_calls = 0;
+
+    //Only written by this worker's thread, on their own line as stats() reads them from any thread
+    struct alignas(cache_line_size) Counters
+    {
+        StatCounter executed;
+        StatCounter stolen;
+        StatCounter failed_steals;
+        StatCounter queue_high_water;
+        StatCounter idle_ns;
+        StatCounter busy_ns;
+    };
+    Counters m_counters;
+
+    std::atomic<bool> m_tracing{false};
+    //Where the job returned by the last get_job came from, see TraceEvent::source
+    int32_t m_job_source = 0;
+    TraceBuffer m_trace;
+
+    WorkStealingQueue<> m_queues_by_priority[num_priorities];
+    JobAllocator m_allocator;
+};
+
+static_assert(alignof(JobWorker) == cache_line_size, "JobWorker must start on a cache line");
+static_assert(sizeof(JobWorker) % cache_line_size == 0, "JobWorker must fill whole cache lines");
+
+class JobSystem
+{
+public:
+
+    /**
+     * @brief
+     * JobSystem Create a new job system, this should preferably be a singleton
+     * as the job system creates one thread per "hardware" thread
+     */
+    JobSystem(std::size_t num_workers = std::thread::hardware_concurrency(), const IdlePolicy& idle_policy = IdlePolicy(),
+              const StealPolicy& steal_policy = StealPolicy(), const AffinityPolicy& affinity_policy = AffinityPolicy(),
+              const BlockingPolicy& blocking_policy = BlockingPolicy(), const IoPolicy& io_policy = IoPolicy()) :
+        m_owner_thread(std::this_thread::get_id()),
+        m_blocking_pool(&m_completion_event, &JobSystem::submit_continuation, this, blocking_policy)
+    {
+        //Initialize workers
+        assert(num_workers != 0);
+        if(io_policy.use_io_uring) m_io_ring.open(io_policy.ring_entries);
+
+        m_workers.resize(num_workers);
+        m_queues.resize(num_workers * num_priorities);
+
+        //Pick a cpu for every worker and let the topology decide the steal order
+        std::vector<CpuTopology::Cpu> worker_cpus;
+        StealPolicy worker_steal_policy = steal_policy;
+        CpuTopology topology;
+        if(affinity_policy.pin_threads && topology.load(affinity_policy.sysfs_root))
+        {
+            const std::vector<CpuTopology::Cpu> placement = topology.placement();
+            for(std::size_t i=0; i < num_workers; i++)
+            {
+                worker_cpus.push_back(placement[i % placement.size()]);
+            }
+            if(worker_steal_policy.worker_groups.empty() && worker_steal_policy.worker_cores.empty())
+            {
+                for(const CpuTopology::Cpu& cpu : worker_cpus)
+                {
+                    worker_steal_policy.worker_groups.push_back(cpu.node);
+                    worker_steal_policy.worker_cores.push_back(cpu.core);
+                }
+            }
+        }
+
+        //Every worker is created on it's own thread after pinning it, so it's queues and allocator
+        //are first touched, and therefore placed, on the NUMA node the worker runs on
+        auto create_worker = [this, num_workers, &idle_policy, &worker_steal_policy, &worker_cpus](std::size_t i)
+        {
+            if(!worker_cpus.empty()) CpuTopology::pin_current_thread(worker_cpus[i].cpu);
+            m_workers[i] = std::make_unique<JobWorker>(this, i, num_workers, m_queues.data(), m_injection_queues,
+                                                       &m_idle_event, &m_completion_event, &m_blocking_pool,
+                                                       &m_io_ring, &m_timers, idle_policy, worker_steal_policy);
+        };
+        //Worker 0 is the calling thread, it is only lent to the job system
+        if(!worker_cpus.empty()) m_owner_affinity = CpuTopology::get_current_affinity();
+        create_worker(0);
+        m_workers[0]->bind_to_current_thread();
+
+        std::atomic<std::size_t> created_workers{1};
+        std::vector<std::thread> threads;
+        for(std::size_t i=1; i < num_workers; i++)
+        {
+            threads.emplace_back([this, i, &create_worker, &created_workers]()
+            {
+                create_worker(i);
+                created_workers.fetch_add(1, std::memory_order_release);
+                //Stealing reads every worker's queues, wait until all of them exist
+                while(!m_workers_started.load(std::memory_order_acquire)) std::this_thread::yield();
+                m_workers[i]->thread_function();
+            });
+        }
+        while(created_workers.load(std::memory_order_acquire) != num_workers) std::this_thread::yield();
+
+        for(std::size_t i=0; i < num_workers; i++)
+        {
+            for(std::size_t p=0; p < num_priorities; p++)
+            {
+                m_queues[i * num_priorities + p] = m_workers[i]->get_queue(static_cast<JobPriority>(p));
+            }
+        }
+        //Start workers
+        for(std::size_t i=1; i < num_workers; i++)
+        {
+            m_workers[i]->set_active(true);
+            m_workers[i]->set_thread(std::move(threads[i - 1u]));
+        }
+        m_workers_started.store(true, std::memory_order_release);
+    }
+
+    ~JobSystem()
+    {
+        assert(std::this_thread::get_id() == m_owner_thread && "A job system must be destroyed by the thread that created it");
+        //current() must not keep returning worker 0 once it is destroyed, the other workers' threads end below
+        m_workers[0]->unbind_current_thread();
+        CpuTopology::set_current_affinity(m_owner_affinity);
+        //Blocking jobs may still hand continuations to the workers
+        m_blocking_pool.shutdown();
+        for(std::size_t i=1; i < m_workers.size(); i++)
+        {
+            m_workers[i]->set_active(false);
+        }
+        m_idle_event.notify_all();
+        for(std::size_t i=1; i < m_workers.size(); i++)
+        {
+            m_workers[i]->get_thread().join();
+        }
+        m_queues.clear();
+        m_workers.clear();
+    }
+
+    /**
+     * @brief get_current_worker Get the worker of this job system that is bound to the calling thread
+     * @return nullptr if called from a thread that is not one of this system's workers
+     */
+    JobWorker* get_current_worker() const
+    {
+        JobWorker* worker = JobWorker::current();
+        if(worker && worker->get_system() == this) return worker;
+        //The owner thread may have created another job system since, which rebinds current()
+        if(std::this_thread::get_id() == m_owner_thread) return m_workers[0].get();
+        return nullptr;
+    }
+
+
+    /**
+     * @brief get_allocator Get the job allocator of the calling worker
+     * NOTE: Must be called from a worker thread or the thread that created the job system
+     * @return
+     */
+    JobAllocator& get_allocator()
+    {
+        JobWorker* worker = get_current_worker();
+        assert(worker != nullptr);
+        return worker->get_allocator();
+    }
+
+    /**
+     * @brief create_job
+     * @param function
+     * @return
+     */
+    Job* create_job(JobFunction function)
+    {
+        Job* job = allocate_job();
+        job->pfn = function;
+        job->parent = nullptr;
+        job->unfinished_jobs = 1;
+        job->continuation_count = 0;
+        job->priority = JobPriority::normal;
+        return job;
+    }
+
+    /**
+     * @brief create_job Create a job that calls fn(), the callable is stored inline in the job's payload
+     * when it fits, otherwise in the allocator's payload arena. It is destroyed right after it ran.
+     * @param fn Any callable taking no arguments, such as a capturing lambda
+     * @return
+     */
+    template<typename Function,
+             typename = typename std::enable_if<!std::is_convertible<Function, JobFunction>::value>::type>
+    Job* create_job(Function&& fn)
+    {
+        Job* job = create_job(JobFunction(nullptr));
+        store_callable(job, std::forward<Function>(fn));
+        return job;
+    }
+
+    /**
+     * @brief create_job_as_child
+     * @param parent
+     * @param function
+     * @return
+     */
+    Job* create_job_as_child(Job* parent, JobFunction function)
+    {
+        //Atomic increment
+        parent->unfinished_jobs++;
+
+        Job* job = allocate_job();
+        job->pfn = function;
+        job->parent = parent;
+        job->unfinished_jobs = 1;
+        job->continuation_count = 0;
+        //Children inherit the priority, so the subtree of an urgent job stays urgent
+        job->priority = parent->priority;
+        return job;
+    }
+
+    /**
+     * @brief create_job_as_child Create a child job that calls fn(), see create_job
+     * @param parent
+     * @param fn Any callable taking no arguments, such as a capturing lambda
+     * @return
+     */
+    template<typename Function,
+             typename = typename std::enable_if<!std::is_convertible<Function, JobFunction>::value>::type>
+    Job* create_job_as_child(Job* parent, Function&& fn)
+    {
+        Job* job = create_job_as_child(parent, JobFunction(nullptr));
+        store_callable(job, std::forward<Function>(fn));
+        return job;
+    }
+
+    /**
+     * @brief create_children Create count children of parent that all call function, parent's counter is raised
+     * once for all of them. Pass the children to enqueue_batch
+     * NOTE: Every child holds an allocator slot until it ran, so count plus the jobs already in flight
+     * must fit in JobAllocator::capacity, split larger batches
+     * @param parent
+     * @param count
+     * @param function
+     * @param children Receives the count new jobs
+     */
+    void create_children(Job* parent, std::size_t count, JobFunction function, Job** children)
+    {
+        assert(count < JobAllocator::capacity);
+        parent->unfinished_jobs.fetch_add(static_cast<uint32_t>(count), std::memory_order_relaxed);
+        for(std::size_t i=0; i < count; i++)
+        {
+            Job* job = allocate_job();
+            job->pfn = function;
+            job->parent = parent;
+            job->unfinished_jobs = 1;
+            job->continuation_count = 0;
+            job->priority = parent->priority;
+            children[i] = job;
+        }
+    }
+
+    /**
+     * @brief create_children Create count children of parent where child i calls fn(i), see create_children
+     * @param parent
+     * @param count
+     * @param fn Any callable taking the child's index, copied into every child
+     * @param children Receives the count new jobs
+     */
+    template<typename Function,
+             typename = typename std::enable_if<!std::is_convertible<Function, JobFunction>::value>::type>
+    void create_children(Job* parent, std::size_t count, const Function& fn, Job** children)
+    {
+        create_children(parent, count, JobFunction(nullptr), children);
+        for(std::size_t i=0; i < count; i++)
+        {
+            store_callable(children[i], [fn, i]() { fn(i); });
+        }
+    }
+
+    /**
+     * @brief current_worker_idx Get the index of the worker running on the calling thread
+     * @return -1 if called from a thread that is not one of this system's workers
+     */
+    int current_worker_idx() const
+    {
+        const JobWorker* worker = get_current_worker();
+        return worker ? worker->get_worker_idx() : -1;
+    }
+
+    /**
+     * @brief add_continuation Run continuation once ancestor and all it's children has finished execution,
+     * the continuation is pushed onto the queue of the worker that finished ancestor.
+     * NOTE: Must be called before ancestor is enqueued, continuation must not be enqueued by the caller
+     * @param ancestor
+     * @param continuation
+     */
+    void add_continuation(Job* ancestor, Job* continuation)
+    {
+        const bool added = try_add_continuation(ancestor, continuation);
+        assert(added);
+        (void)added;
+    }
+
+    /**
+     * @brief try_add_continuation Like add_continuation, but threadsafe and may be called after ancestor was enqueued
+     * @param ancestor
+     * @param continuation
+     * @return false if ancestor already finished or has no room left, continuation was not added
+     */
+    bool try_add_continuation(Job* ancestor, Job* continuation)
+    {
+        uint32_t count = ancestor->continuation_count.load(std::memory_order_acquire);
+        do
+        {
+            //Also fails once the finishing worker closed or released the list
+            if(count >= max_continuations) return false;
+        }
+        while(!ancestor->continuation_count.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel,
+                                                                  std::memory_order_acquire));
+        ancestor->continuations[count].store(continuation, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief enqueue Enqueue the given job, threadsafe
+     * jobs submitted from a worker go onto that worker's own queue, so recursive fan out stays
+     * local and other workers only steal when they run dry. Jobs submitted from any other thread
+     * go through the injection queue
+     * @param job
+     */
+    void enqueue(Job* job)
+    {
+        if(job->blocking)
+        {
+            m_blocking_pool.push(job);
+            return;
+        }
+        JobWorker* worker = get_current_worker();
+        if(worker)
+        {
+            worker->run(job);
+            return;
+        }
+        while(!m_injection_queues[static_cast<std::size_t>(job->priority)].push(job))
+        {
+            //The injection queue is full, wait for the workers to drain it
+            m_idle_event.notify_all();
+            std::this_thread::yield();
+        }
+        m_idle_event.notify();
+    }
+
+    /**
+     * @brief enqueue_batch Enqueue count jobs, threadsafe. From a worker the jobs are published to thieves
+     * all at once and sleeping workers are woken in proportion to the batch, from any other thread
+     * they go through the injection queue one by one, followed by a single wake up
+     * @param jobs
+     * @param count
+     */
+    void enqueue_batch(Job* const* jobs, std::size_t count)
+    {
+        if(count == 0) return;
+        JobWorker* worker = get_current_worker();
+        if(worker)
+        {
+            worker->run_batch(jobs, count);
+            return;
+        }
+        for(std::size_t i=0; i < count; i++)
+        {
+            while(!m_injection_queues[static_cast<std::size_t>(jobs[i]->priority)].push(jobs[i]))
+            {
+                m_idle_event.notify_all();
+                std::this_thread::yield();
+            }
+        }
+        m_idle_event.notify(static_cast<uint32_t>(std::min(count, m_workers.size())));
+    }
+
+    /**
+     * @brief enqueue_blocking Enqueue a job that blocks, such as one reading a file or sleeping, threadsafe.
+     * It runs on the blocking pool so no worker stalls on it, when it finishes it counts down it's parent
+     * and it's continuations are enqueued like those of any other job.
+     * Continuations with Job::blocking set also go to the blocking pool
+     * @param job
+     */
+    void enqueue_blocking(Job* job)
+    {
+        job->blocking = true;
+        m_blocking_pool.push(job);
+    }
+
+    /**
+     * @brief submit_read Read request->size bytes at request->offset of request->fd into request->buffer, threadsafe.
+     * No worker blocks on the read, it counts as a child of job so job does not finish, and it's continuations
+     * do not run, before the read completed and request->result holds the bytes read or -errno.
+     * Uses io_uring when available, completions are reaped by idle workers. Otherwise the read runs on the blocking pool
+     * NOTE: request must stay alive until job has finished
+     * @param job
+     * @param request
+     */
+    void submit_read(Job* job, IoRequest* request) { submit_io(job, request, false); }
+
+    /**
+     * @brief submit_write Write request->size bytes from request->buffer at request->offset of request->fd, see submit_read
+     * @param job
+     * @param request
+     */
+    void submit_write(Job* job, IoRequest* request) { submit_io(job, request, true); }
+
+    /**
+     * @brief enqueue_at Enqueue the job once time has come, threadsafe. Until then it waits in a timing wheel
+     * that idle workers service as they look for jobs, it runs late by at most a tick plus the time an idle
+     * worker takes to notice, unless every worker is busy. A time already passed enqueues the job right away.
+     * The job is not tied to the calling thread, use it for retries, flushes or frame ticks that would
+     * otherwise need a timer thread. Jobs still waiting when the job system is destroyed never run
+     * @param job
+     * @param time
+     */
+    void enqueue_at(Job* job, std::chrono::steady_clock::time_point time)
+    {
+        if(!m_timers.insert(job, time))
+        {
+            enqueue(job);
+            return;
+        }
+        //A parked worker may sleep without a timeout, wake one so it sleeps until the new deadline instead
+        m_idle_event.notify();
+    }
+
+    /**
+     * @brief enqueue_after Enqueue the job once delay has passed, threadsafe, see enqueue_at
+     * @param job
+     * @param delay
+     */
+    template<typename Rep, typename Period>
+    void enqueue_after(Job* job, const std::chrono::duration<Rep, Period>& delay)
+    {
+        enqueue_at(job, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+    }
+
+    /**
+     * @brief pending_timers Jobs passed to enqueue_at or enqueue_after that are still waiting for their time
+     * @return
+     */
+    uint32_t pending_timers() const { return m_timers.pending(); }
+
+    /**
+     * @brief uses_io_uring Whether transfers go through io_uring rather than the blocking pool
+     * @return
+     */
+    bool uses_io_uring() const { return m_io_ring.is_open(); }
+
+    /**
+     * @brief enqueue Set the priority of the given job and enqueue it, see enqueue
+     * @param job
+     * @param priority
+     */
+    void enqueue(Job* job, JobPriority priority)
+    {
+        job->priority = priority;
+        enqueue(job);
+    }
+
+    /**
+     * @brief stats Threadsafe snapshot of every worker's counters, all zero when compiled with MJOB_STATS 0
+     * @return
+     */
+    JobSystemStats stats() const
+    {
+        JobSystemStats stats;
+        for(const std::unique_ptr<JobWorker>& worker : m_workers)
+        {
+            const WorkerStats worker_stats = worker->get_stats();
+            stats.total.executed += worker_stats.executed;
+            stats.total.stolen += worker_stats.stolen;
+            stats.total.failed_steals += worker_stats.failed_steals;
+            stats.total.queue_high_water = std::max(stats.total.queue_high_water, worker_stats.queue_high_water);
+            stats.total.idle_ns += worker_stats.idle_ns;
+            stats.total.busy_ns += worker_stats.busy_ns;
+            stats.workers.push_back(worker_stats);
+        }
+        stats.blocking_executed = m_blocking_pool.executed();
+        stats.blocking_peak_threads = m_blocking_pool.peak_threads();
+        return stats;
+    }
+
+    /**
+     * @brief set_tracing Start or stop recording every executed job, see write_chrome_trace
+     * NOTE: Has no effect unless compiled with MJOB_TRACE 1
+     * @param tracing
+     */
+    void set_tracing(bool tracing)
+    {
+        if(tracing)
+        {
+            m_trace_start_ticks = read_timestamp();
+            m_trace_start = std::chrono::steady_clock::now();
+        }
+        for(const std::unique_ptr<JobWorker>& worker : m_workers)
+        {
+            worker->set_tracing(tracing);
+        }
+    }
+
+    /**
+     * @brief write_chrome_trace Write the recorded jobs as Chrome Trace Event JSON, which chrome://tracing
+     * and ui.perfetto.dev open. Every worker is a thread, every job a complete event.
+     * NOTE: Call while no jobs run, such as after wait returned, or recent events may be torn
+     * @param out
+     */
+    void write_chrome_trace(std::ostream& out) const
+    {
+        //Convert timestamps to microseconds using the time elapsed since tracing started
+        const uint64_t end_ticks = read_timestamp();
+        const double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_trace_start).count();
+        const double us_per_tick = end_ticks > m_trace_start_ticks && elapsed_us > 0 ?
+                                   elapsed_us / static_cast<double>(end_ticks - m_trace_start_ticks) : 0.0;
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        const char* separator = "";
+        for(std::size_t i=0; i < m_workers.size(); i++)
+        {
+            out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i <<
+                   ",\"args\":{\"name\":\"worker " << i << "\"}}";
+            separator = ",";
+            m_workers[i]->get_trace().for_each([&](const TraceEvent& event)
+            {
+                if(event.begin < m_trace_start_ticks) return;
+                out << ",{\"name\":\"job\",\"ph\":\"X\",\"pid\":0,\"tid\":" << i <<
+                       ",\"ts\":" << static_cast<double>(event.begin - m_trace_start_ticks) * us_per_tick <<
+                       ",\"dur\":" << static_cast<double>(event.end - event.begin) * us_per_tick <<
+                       ",\"args\":{\"job\":\"" << static_cast<const void*>(event.job) <<
+                       "\",\"parent\":\"" << static_cast<const void*>(event.parent) <<
+                       "\",\"source\":" << event.source << "}}";
+            });
+        }
+        out << "]}";
+    }
+
+    /**
+     * @brief has_job_completed Check whether the given job and all it's children has finished execution
+     * @param job
+     * @return
+     */
+    bool has_job_completed(const Job* job) const { return job->unfinished_jobs == 0; }
+
+    /**
+     * @brief is_descendant Check whether job is ancestor itself or one of it's (grand)children
+     * @param job
+     * @param ancestor
+     * @return
+     */
+    static bool is_descendant(const Job* job, const Job* ancestor)
+    {
+        for(; job; job = job->parent)
+        {
+            if(job == ancestor) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief wait Wait for the given job and all it's children to finish execution, threadsafe.
+     * Threads that are not workers always wait in WaitMode::park
+     * @param job
+     * @param mode What to do while waiting
+     */
+    void wait(const Job* job, WaitMode mode = WaitMode::help_any)
+    {
+        job->waiters.fetch_add(1, std::memory_order_seq_cst);
+        wait_until([&]() { return has_job_completed(job); },
+                   [&](const Job* candidate) { return is_descendant(candidate, job); }, mode);
+        job->waiters.fetch_sub(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief wait_all Wait for all of the given jobs to finish execution, see wait
+     * @param jobs
+     * @param count
+     * @param mode
+     */
+    void wait_all(const Job* const* jobs, std::size_t count, WaitMode mode = WaitMode::help_any)
+    {
+        for(std::size_t i=0; i < count; i++)
+        {
+            wait(jobs[i], mode);
+        }
+    }
+
+    void wait_all(std::initializer_list<const Job*> jobs, WaitMode mode = WaitMode::help_any)
+    {
+        wait_all(jobs.begin(), jobs.size(), mode);
+    }
+
+    /**
+     * @brief wait_any Wait for at least one of the given jobs to finish execution, see wait
+     * @param jobs
+     * @param count
+     * @param mode
+     * @return Index of a job that has completed
+     */
+    std::size_t wait_any(const Job* const* jobs, std::size_t count, WaitMode mode = WaitMode::help_any)
+    {
+        assert(count != 0);
+        std::size_t completed = count;
+        for(std::size_t i=0; i < count; i++) jobs[i]->waiters.fetch_add(1, std::memory_order_seq_cst);
+        wait_until([&]()
+        {
+            for(std::size_t i=0; i < count; i++)
+            {
+                if(has_job_completed(jobs[i]))
+                {
+                    completed = i;
+                    return true;
+                }
+            }
+            return false;
+        },
+        [&](const Job* candidate)
+        {
+            for(std::size_t i=0; i < count; i++)
+            {
+                if(is_descendant(candidate, jobs[i])) return true;
+            }
+            return false;
+        }, mode);
+        for(std::size_t i=0; i < count; i++) jobs[i]->waiters.fetch_sub(1, std::memory_order_release);
+        return completed;
+    }
+
+    std::size_t wait_any(std::initializer_list<const Job*> jobs, WaitMode mode = WaitMode::help_any)
+    {
+        return wait_any(jobs.begin(), jobs.size(), mode);
+    }
+
+    /**
+     * @brief parallel_range Call fn(range_begin, range_end) over sub ranges of [begin, end) in parallel
+     * and wait for all of them to finish. Ranges are split in half lazily, only when the executing
+     * worker's queue has been drained by thieves, so the split depth adapts to how hungry the other
+     * workers are, down to grain items per call.
+     * @param begin
+     * @param end
+     * @param grain Smallest range passed to fn, 0 picks one based on the number of workers
+     * @param fn Callable as fn(std::size_t, std::size_t), may be called concurrently
+     */
+    template<typename Function>
+    void parallel_range(std::size_t begin, std::size_t end, std::size_t grain, Function&& fn)
+    {
+        if(begin >= end) return;
+        using FunctionType = typename std::remove_reference<Function>::type;
+
+        ParallelRangeContext context;
+        context.system = this;
+        context.grain = grain != 0 ? grain : std::max<std::size_t>(1u, (end - begin) / (8u * m_workers.size()));
+        context.invoke = [](void* fn, std::size_t range_begin, std::size_t range_end)
+        {
+            (*static_cast<FunctionType*>(fn))(range_begin, range_end);
+        };
+        context.fn = const_cast<void*>(static_cast<const void*>(&fn));
+
+        //The root covers the whole range, every split becomes one of it's children
+        Job* root = create_job([&context, begin, end]() { run_parallel_range(&context, begin, end); });
+        context.root = root;
+        enqueue(root);
+        wait(root);
+    }
+
+    /**
+     * @brief parallel_for Call fn(i) for every i in [begin, end) in parallel and wait for all of them to finish
+     * @param begin
+     * @param end
+     * @param grain Smallest number of indices handled by one job, 0 picks one based on the number of workers
+     * @param fn Callable as fn(std::size_t), may be called concurrently
+     */
+    template<typename Function>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Function&& fn)
+    {
+        parallel_range(begin, end, grain, [&fn](std::size_t range_begin, std::size_t range_end)
+        {
+            for(std::size_t i=range_begin; i < range_end; i++) fn(i);
+        });
+    }
+
+private:
+
+    /**
+     * @brief wait_until Help or park according to mode until completed() returns true
+     * @param completed Callable as completed()
+     * @param is_related Callable as is_related(const Job*), whether a job helps towards completed()
+     * @param mode
+     */
+    template<typename Completed, typename IsRelated>
+    void wait_until(Completed completed, IsRelated is_related, WaitMode mode)
+    {
+        JobWorker* worker = get_current_worker();
+        if(worker == nullptr) mode = WaitMode::park;
+        uint32_t idle_rounds = 0;
+        while(!completed())
+        {
+            bool helped = false;
+            if(mode == WaitMode::help_any) helped = worker->try_execute();
+            else if(mode == WaitMode::help_related) helped = worker->try_execute_if(is_related);
+            if(helped)
+            {
+                idle_rounds = 0;
+                continue;
+            }
+            if(mode != WaitMode::park && idle_rounds++ < wait_spin_count)
+            {
+                cpu_relax();
+                continue;
+            }
+            //Nothing useful to do, sleep until a job completes
+            const uint64_t key = m_completion_event.prepare_wait();
+            if(completed())
+            {
+                m_completion_event.cancel_wait();
+                return;
+            }
+            if(mode == WaitMode::park)
+            {
+                m_completion_event.wait(key);
+            }
+            else
+            {
+                //Jobs enqueued while we sleep do not wake us, check back for something to help with,
+                //in time for the next timer as we may be the only one to service it
+                const int64_t until_timer_ns = m_timers.ns_until_next();
+                if(until_timer_ns < wait_timer_wake_early.count())
+                {
+                    m_completion_event.cancel_wait();
+                    std::this_thread::yield();
+                    continue;
+                }
+                const std::chrono::nanoseconds timeout(std::min<int64_t>(until_timer_ns - wait_timer_wake_early.count(),
+                                                                         wait_help_interval.count()));
+                m_completion_event.wait_for(key, timeout);
+                idle_rounds = 0;
+            }
+        }
+    }
+
+    //Failed attempts to help spent spinning before a helping wait parks
+    static constexpr uint32_t wait_spin_count = 256u;
+    //How long a helping wait sleeps before looking for jobs again
+    static constexpr std::chrono::nanoseconds wait_help_interval{500000};
+    //How long before a deadline a helping wait wakes up, see JobWorker::timer_wake_early
+    static constexpr std::chrono::nanoseconds wait_timer_wake_early{200000};
+
+    struct ParallelRangeContext
+    {
+        JobSystem* system;
+        Job* root;
+        std::size_t grain;
+        void (*invoke)(void* fn, std::size_t range_begin, std::size_t range_end);
+        void* fn;
+    };
+
+    static void run_parallel_range(const ParallelRangeContext* context, std::size_t begin, std::size_t end)
+    {
+        JobSystem* system = context->system;
+        JobWorker* worker = system->get_current_worker();
+        while(end - begin > context->grain)
+        {
+            if(worker->get_queue(context->root->priority)->is_empty())
+            {
+                //Nothing left for thieves to take, hand them the upper half
+                const std::size_t middle = begin + (end - begin) / 2;
+                system->enqueue(system->create_job_as_child(context->root, [context, middle, end]()
+                {
+                    run_parallel_range(context, middle, end);
+                }));
+                end = middle;
+            }
+            else
+            {
+                //Our last split has not been stolen yet, keep working through our own range
+                context->invoke(context->fn, begin, begin + context->grain);
+                begin += context->grain;
+            }
+        }
+        context->invoke(context->fn, begin, end);
+    }
+
+    /**
+     * @brief store_callable Move fn into the job's payload, or into payload arena storage
+     * pointed to by the payload when it does not fit
+     * @param job
+     * @param fn
+     */
+    template<typename Function>
+    void store_callable(Job* job, Function&& fn)
+    {
+        using Callable = typename std::decay<Function>::type;
+        //The payload sits inside the job, so it is only as aligned as payload_alignment and not like Job itself
+        if constexpr(sizeof(Callable) <= sizeof(Job::payload) && alignof(Callable) <= payload_alignment)
+        {
+            new (job->payload) Callable(std::forward<Function>(fn));
+            job->pfn = [](const void* payload)
+            {
+                Callable* callable = static_cast<Callable*>(const_cast<void*>(payload));
+                (*callable)();
+                callable->~Callable();
+            };
+        }
+        else
+        {
+            //Over aligned callables, such as ones capturing SIMD vectors, get enough slack to be aligned up
+            constexpr std::size_t slack = alignof(Callable) > PayloadArena::alignment ? alignof(Callable) - PayloadArena::alignment : 0u;
+            std::size_t space = sizeof(Callable) + slack;
+            void* storage = allocate_payload(job, space);
+            storage = std::align(alignof(Callable), sizeof(Callable), storage, space);
+            *reinterpret_cast<Callable**>(job->payload) = new (storage) Callable(std::forward<Function>(fn));
+            job->pfn = [](const void* payload)
+            {
+                Callable* callable = *static_cast<Callable* const*>(payload);
+                (*callable)();
+                callable->~Callable();
+            };
+        }
+    }
+
+    /**
+     * @brief allocate_payload Allocate arena storage for a job's callable from the same allocator as
+     * create_job would. If the arena is full of jobs still in flight, help out until one is freed
+     * @param job
+     * @param size
+     * @return
+     */
+    void* allocate_payload(const Job* job, std::size_t size)
+    {
+        JobWorker* worker = get_current_worker();
+        if(worker == nullptr)
+        {
+            void* storage = m_external_allocator.allocate_payload(job, size);
+            while(storage == nullptr)
+            {
+                std::this_thread::yield();
+                storage = m_external_allocator.allocate_payload(job, size);
+            }
+            return storage;
+        }
+        void* storage = worker->get_allocator().allocate_payload(job, size);
+        while(storage == nullptr)
+        {
+            worker->fetch_and_execute();
+            storage = worker->get_allocator().allocate_payload(job, size);
+        }
+        return storage;
+    }
+
+    void submit_io(Job* job, IoRequest* request, bool write)
+    {
+        request->job = job;
+        if(!m_io_ring.is_open())
+        {
+            //The transfer becomes a blocking child of job
+            enqueue_blocking(create_job_as_child(job, [request, write]()
+            {
+                request->result = transfer_blocking(*request, write);
+            }));
+            return;
+        }
+        job->unfinished_jobs++;
+        JobWorker* worker = get_current_worker();
+        while(!m_io_ring.submit(request, write))
+        {
+            //Too many transfers in flight, help out until the workers reaped some
+            if(worker) worker->fetch_and_execute();
+            else std::this_thread::yield();
+        }
+    }
+
+    //Enqueues the continuations of jobs finished by the blocking pool
+    static void submit_continuation(void* system, Job* continuation)
+    {
+        static_cast<JobSystem*>(system)->enqueue(continuation);
+    }
+
+    /**
+     * @brief allocate_job Allocate a job from the calling worker's allocator, or the shared allocator
+     * when called from any other thread. If every slot is still in flight, help out until one is freed
+     * @return
+     */
+    Job* allocate_job()
+    {
+        JobWorker* worker = get_current_worker();
+        if(worker == nullptr)
+        {
+            Job* job = m_external_allocator.allocate();
+            while(job == nullptr)
+            {
+                std::this_thread::yield();
+                job = m_external_allocator.allocate();
+            }
+            return job;
+        }
+        Job* job = worker->get_allocator().allocate();
+        while(job == nullptr)
+        {
+            worker->fetch_and_execute();
+            job = worker->get_allocator().allocate();
+        }
+        return job;
+    }
+
+    std::thread::id m_owner_thread;
+    //Affinity of the owner thread before worker 0 was pinned, restored on destruction
+    CpuTopology::Affinity m_owner_affinity;
+    std::atomic<bool> m_workers_started{false};
+    uint64_t m_trace_start_ticks = 0;
+    std::chrono::steady_clock::time_point m_trace_start;
     std::vector<std::unique_ptr<JobWorker>> m_workers;
     std::vector<WorkStealingQueue<>*> m_queues;
-    JobAllocator m_job_allocator;
+    InjectionQueue<> m_injection_queues[num_priorities];
+    SharedJobAllocator m_external_allocator;
+    EventCount m_idle_event;
+    EventCount m_completion_event;
+    BlockingPool m_blocking_pool;
+    IoRing m_io_ring;
+    TimerWheel m_timers;
+};
+
+
+/**
+ * A dependency graph that is declared and compiled once, then run as many times as needed.
+ * Compiling turns the edges into a successor list and a dependency count per node, running the graph
+ * resets the counters in place and enqueues the nodes without dependencies. Every node owns a job
+ * for the lifetime of the graph, so running it does not allocate
+ */
+class JobGraph
+{
+public:
+    using NodeId = uint32_t;
+
+    explicit JobGraph(JobSystem& job_system) :
+        m_job_system(job_system)
+    {}
+
+    /**
+     * @brief add_node Add a node that calls fn() every time the graph runs
+     * NOTE: Not threadsafe, invalidates the compiled graph
+     * @param fn Callable taking no arguments
+     * @return
+     */
+    template<typename Function>
+    NodeId add_node(Function&& fn)
+    {
+        m_functions.emplace_back(std::forward<Function>(fn));
+        m_compiled = false;
+        return static_cast<NodeId>(m_functions.size() - 1u);
+    }
+
+    /**
+     * @brief add_edge Make to wait for from to finish
+     * NOTE: Not threadsafe, invalidates the compiled graph
+     * @param from
+     * @param to
+     */
+    void add_edge(NodeId from, NodeId to)
+    {
+        assert(from < m_functions.size() && to < m_functions.size());
+        m_edges.emplace_back(from, to);
+        m_compiled = false;
+    }
+
+    /**
+     * @brief compile Build the successor lists, dependency counts and node jobs
+     * @return false if the graph has a cycle
+     */
+    bool compile()
+    {
+        const std::size_t num_nodes = m_functions.size();
+        m_dependencies.assign(num_nodes, 0u);
+        m_successor_offsets.assign(num_nodes + 1u, 0u);
+        m_successors.resize(m_edges.size());
+        for(const std::pair<NodeId, NodeId>& edge : m_edges)
+        {
+            m_successor_offsets[edge.first + 1u]++;
+            m_dependencies[edge.second]++;
+        }
+        for(std::size_t i=0; i < num_nodes; i++)
+        {
+            m_successor_offsets[i + 1u] += m_successor_offsets[i];
+        }
+        std::vector<uint32_t> fill(m_successor_offsets.begin(), m_successor_offsets.end() - 1);
+        for(const std::pair<NodeId, NodeId>& edge : m_edges)
+        {
+            m_successors[fill[edge.first]++] = edge.second;
+        }
+
+        m_roots.clear();
+        for(NodeId i=0; i < num_nodes; i++)
+        {
+            if(m_dependencies[i] == 0) m_roots.push_back(i);
+        }
+
+        //Every node has to be reachable in topological order, otherwise there is a cycle
+        std::vector<uint32_t> remaining(m_dependencies);
+        std::vector<NodeId> ready(m_roots);
+        std::size_t visited = 0;
+        while(!ready.empty())
+        {
+            const NodeId node = ready.back();
+            ready.pop_back();
+            visited++;
+            for(uint32_t i=m_successor_offsets[node]; i < m_successor_offsets[node + 1u]; i++)
+            {
+                if(--remaining[m_successors[i]] == 0) ready.push_back(m_successors[i]);
+            }
+        }
+        if(visited != num_nodes) return false;
+
+        m_pending.reset(new std::atomic<uint32_t>[num_nodes]);
+        //One job per node plus the completion job every node is a child of
+        m_jobs.reset(new Job[num_nodes + 1u]);
+        m_completion_job = &m_jobs[num_nodes];
+        //The completion job is never run, it is only finished by the node jobs
+        for(NodeId i=0; i <= num_nodes; i++)
+        {
+            Job& job = m_jobs[i];
+            job.pfn = i < num_nodes ? run_node : nullptr;
+            new (job.payload) NodeRef{this, i};
+            job.unfinished_jobs = 0;
+            job.continuation_count = continuations_released;
+            for(std::atomic<Job*>& continuation : job.continuations) continuation = nullptr;
+        }
+        m_compiled = true;
+        return true;
+    }
+
+    /**
+     * @brief launch Run the graph without waiting for it, the previous run must have completed
+     * @param priority Priority of every node's job
+     * @return Job that completes once every node has run, pass it to JobSystem::wait
+     */
+    Job* launch(JobPriority priority = JobPriority::normal)
+    {
+        assert(m_compiled);
+        assert(m_job_system.has_job_completed(m_completion_job));
+        const std::size_t num_nodes = m_functions.size();
+        if(num_nodes == 0) return m_completion_job;
+        //The worker that finished the previous run may still be releasing the completion job
+        while(!is_job_free(m_completion_job)) cpu_relax();
+        m_completion_job->parent = nullptr;
+        m_completion_job->priority = priority;
+        m_completion_job->continuation_count.store(0, std::memory_order_relaxed);
+        m_completion_job->unfinished_jobs.store(static_cast<uint32_t>(num_nodes), std::memory_order_relaxed);
+        for(std::size_t i=0; i < num_nodes; i++)
+        {
+            m_pending[i].store(m_dependencies[i], std::memory_order_relaxed);
+            Job& job = m_jobs[i];
+            job.parent = m_completion_job;
+            job.priority = priority;
+            job.continuation_count.store(0, std::memory_order_relaxed);
+            job.unfinished_jobs.store(1u, std::memory_order_relaxed);
+        }
+        for(NodeId root : m_roots)
+        {
+            //Enqueueing publishes the counters reset above
+            m_job_system.enqueue(&m_jobs[root]);
+        }
+        return m_completion_job;
+    }
+
+    /**
+     * @brief run Run the graph and wait for every node to finish
+     */
+    void run() { m_job_system.wait(launch()); }
+
+    std::size_t size() const { return m_functions.size(); }
+
+private:
+    //Stored in the payload of each node's job
+    struct NodeRef
+    {
+        JobGraph* graph;
+        NodeId node;
+    };
+
+    static void run_node(const void* payload)
+    {
+        const NodeRef* ref = static_cast<const NodeRef*>(payload);
+        JobGraph* graph = ref->graph;
+        const NodeId node = ref->node;
+        graph->m_functions[node]();
+        for(uint32_t i=graph->m_successor_offsets[node]; i < graph->m_successor_offsets[node + 1u]; i++)
+        {
+            const NodeId successor = graph->m_successors[i];
+            //The last dependency to finish enqueues the successor onto it's own worker
+            if(graph->m_pending[successor].fetch_sub(1u, std::memory_order_acq_rel) == 1u)
+            {
+                graph->m_job_system.enqueue(&graph->m_jobs[successor]);
+            }
+        }
+    }
+
+    JobSystem& m_job_system;
+    bool m_compiled = false;
+    std::vector<std::function<void()>> m_functions;
+    std::vector<std::pair<NodeId, NodeId>> m_edges;
+
+    //Compiled graph, the successors of node i are m_successors[m_successor_offsets[i] .. m_successor_offsets[i + 1])
+    std::vector<uint32_t> m_dependencies;
+    std::vector<uint32_t> m_successor_offsets;
+    std::vector<NodeId> m_successors;
+    std::vector<NodeId> m_roots;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_pending;
+    std::unique_ptr<Job[]> m_jobs;
+    Job* m_completion_job = nullptr;
 };
 
 
@@ -0,0 +1,345 @@
+#ifndef MJOB_CORO_HPP
+#define MJOB_CORO_HPP
+
+#include "mjob.hpp"
+
+//For std::coroutine_handle, needs C++20
+#include <coroutine>
+//For std::terminate
+#include <exception>
+//For std::optional
+#include <optional>
+//For std::exchange
+#include <utility>
+
+//Coroutines never block a worker, a coroutine that awaits a job is suspended and a job resuming it is added
+//as a continuation of the awaited job, so it is pushed onto the deque of the worker that finishes it
+
+/**
+ * Coroutine frames are allocated from the frame arena of the worker creating the coroutine, found through the
+ * JobSystem the coroutine takes as it's first parameter. Coroutines without one, created on a thread that is not
+ * a worker of that system or not fitting in the arena come from the heap
+ */
+struct CoroutineFrame
+{
+    //Frames larger than this always come from the heap, so a few large frames do not fill the arena
+    static constexpr std::size_t max_pooled_size = 4096u;
+    //Prefix recording where the frame came from, keeps the frame aligned like operator new would
+    static constexpr std::size_t header_size = PayloadArena::alignment;
+
+    static void* allocate(std::size_t size, JobWorker* worker)
+    {
+        void* storage = nullptr;
+        if(worker && size <= max_pooled_size) storage = worker->get_allocator().allocate_frame(header_size + size);
+        const bool pooled = storage != nullptr;
+        if(!pooled) storage = ::operator new(header_size + size);
+        *static_cast<bool*>(storage) = pooled;
+        return static_cast<unsigned char*>(storage) + header_size;
+    }
+
+    static void free(void* frame)
+    {
+        //May be called from any thread, releasing a pooled frame only flags it, the owning worker reclaims it
+        void* storage = static_cast<unsigned char*>(frame) - header_size;
+        if(*static_cast<bool*>(storage)) PayloadArena::release(storage);
+        else ::operator delete(storage);
+    }
+};
+
+template<typename T = void>
+class Task;
+
+/**
+ * Awaiting a job suspends the coroutine until the job and all it's children finished,
+ * then resumes it on the worker that finished the job.
+ * The awaiter counts as a waiter of the job, so the slot is not handed out again before the coroutine resumed
+ */
+class JobAwaiter
+{
+public:
+    JobAwaiter(JobSystem& job_system, Job* job) :
+        m_job_system(job_system),
+        m_job(job)
+    {
+        m_job->waiters.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    JobAwaiter(const JobAwaiter&) = delete;
+    JobAwaiter& operator=(const JobAwaiter&) = delete;
+
+    ~JobAwaiter()
+    {
+        m_job->waiters.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool await_ready() const { return m_job_system.has_job_completed(m_job); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        resume_after(m_job_system, m_job, awaiting);
+        return true;
+    }
+
+    void await_resume() const {}
+
+private:
+    //How long to wait before looking at a job again when all of it's continuation slots were taken
+    static constexpr std::chrono::microseconds retry_interval{50};
+
+    /**
+     * @brief resume_after Resume awaiting on a job that runs once job completed. Rather than blocking the worker
+     * while every continuation slot is taken, the job is enqueued on a timer and looks again when it runs.
+     * The awaiter keeps job from being handed out again, so the slot still holds the same job by then
+     * NOTE: Once the resume job is added the coroutine may be resumed on another worker at any moment,
+     * the awaiter is part of it's frame so this must not touch it
+     * @param job_system
+     * @param job
+     * @param awaiting
+     */
+    static void resume_after(JobSystem& job_system, Job* job, std::coroutine_handle<> awaiting)
+    {
+        JobSystem* system = &job_system;
+        Job* resume = job_system.create_job([system, job, awaiting]()
+        {
+            if(system->has_job_completed(job)) awaiting.resume();
+            else resume_after(*system, job, awaiting);
+        });
+        resume->priority = job->priority;
+        if(job_system.try_add_continuation(job, resume)) return;
+        if(job_system.has_job_completed(job)) job_system.enqueue(resume);
+        else job_system.enqueue_after(resume, retry_interval);
+    }
+
+    JobSystem& m_job_system;
+    Job* m_job;
+};
+
+/**
+ * @brief schedule Awaiting the result moves the coroutine onto a job, so another worker can steal it
+ * and the code before the co_await runs in parallel with the code after it
+ * @param job_system
+ * @param priority
+ * @return
+ */
+inline auto schedule(JobSystem& job_system, JobPriority priority = JobPriority::normal)
+{
+    struct ScheduleAwaiter
+    {
+        JobSystem& job_system;
+        JobPriority priority;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            job_system.enqueue(job_system.create_job([awaiting]() { awaiting.resume(); }), priority);
+        }
+        void await_resume() const {}
+    };
+    return ScheduleAwaiter{job_system, priority};
+}
+
+class TaskPromiseBase
+{
+public:
+    //Returning to whoever awaits the task is a symmetric transfer, it does not grow the stack
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+        {
+            TaskPromiseBase& promise = finished.promise();
+            if(promise.m_continuation) return promise.m_continuation;
+            //Launched on a job, the frame may be destroyed as soon as the completion job is enqueued
+            JobSystem* job_system = promise.m_job_system;
+            Job* completion = promise.m_completion;
+            if(completion) job_system->enqueue(completion);
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    //Tasks are lazy, they start once awaited or launched
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() const noexcept { std::terminate(); }
+
+    JobAwaiter await_transform(Job* job)
+    {
+        assert(m_job_system != nullptr);
+        return JobAwaiter(*m_job_system, job);
+    }
+
+    template<typename Awaitable>
+    Awaitable&& await_transform(Awaitable&& awaitable) const noexcept { return std::forward<Awaitable>(awaitable); }
+
+    template<typename... Args>
+    static void* operator new(std::size_t size, JobSystem& job_system, Args&...)
+    {
+        return CoroutineFrame::allocate(size, job_system.get_current_worker());
+    }
+    static void* operator new(std::size_t size) { return CoroutineFrame::allocate(size, nullptr); }
+    static void operator delete(void* frame) { CoroutineFrame::free(frame); }
+
+    /**
+     * @brief set_continuation Resume continuation once the task returned
+     * @param continuation
+     * @param job_system The job system jobs awaited inside the task belong to
+     */
+    void set_continuation(std::coroutine_handle<> continuation, JobSystem* job_system)
+    {
+        m_continuation = continuation;
+        m_job_system = job_system;
+    }
+
+    void set_completion(JobSystem* job_system, Job* completion)
+    {
+        m_job_system = job_system;
+        m_completion = completion;
+    }
+
+    JobSystem* get_job_system() const { return m_job_system; }
+
+private:
+    std::coroutine_handle<> m_continuation;
+    JobSystem* m_job_system = nullptr;
+    Job* m_completion = nullptr;
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    template<typename Value>
+    void return_value(Value&& value) { m_value.emplace(std::forward<Value>(value)); }
+
+    T& result() { return *m_value; }
+
+private:
+    std::optional<T> m_value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void() const {}
+    void result() const {}
+};
+
+/**
+ * A lazily started coroutine returning T. Awaiting a task runs it on the awaiting worker and resumes the
+ * awaiting coroutine once it returned. Inside a task jobs can be awaited, see JobAwaiter.
+ * To run tasks in parallel launch them and await the returned jobs
+ */
+template<typename T>
+class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+
+    Task() = default;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) :
+        m_handle(handle)
+    {}
+
+    Task(Task&& other) noexcept :
+        m_handle(std::exchange(other.m_handle, nullptr))
+    {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            if(m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if(m_handle) m_handle.destroy();
+    }
+
+    bool await_ready() const { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting)
+    {
+        static_assert(std::is_base_of<TaskPromiseBase, Promise>::value, "Tasks can only be awaited inside tasks");
+        //The awaited task runs on the awaiting task's job system
+        m_handle.promise().set_continuation(awaiting, awaiting.promise().get_job_system());
+        return m_handle;
+    }
+
+    decltype(auto) await_resume() { return m_handle.promise().result(); }
+
+    /**
+     * @brief launch Start the task on a job without waiting for it
+     * NOTE: The task must not be destroyed before the returned job completed
+     * @param job_system
+     * @param priority
+     * @return Job that completes once the task returned, pass it to JobSystem::wait or co_await it
+     */
+    Job* launch(JobSystem& job_system, JobPriority priority = JobPriority::normal)
+    {
+        assert(m_handle && !m_handle.done());
+        Job* completion = job_system.create_job([]() {});
+        completion->priority = priority;
+        m_handle.promise().set_completion(&job_system, completion);
+        std::coroutine_handle<promise_type> handle = m_handle;
+        job_system.enqueue(job_system.create_job([handle]() { handle.resume(); }), priority);
+        return completion;
+    }
+
+    /**
+     * @brief result Get the value returned by a task that finished
+     * @return
+     */
+    decltype(auto) result()
+    {
+        assert(m_handle.done());
+        return m_handle.promise().result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief sync_wait Run the task and wait for it, the calling thread helps out meanwhile
+ * @param job_system
+ * @param task
+ * @return The task's result
+ */
+template<typename T>
+T sync_wait(JobSystem& job_system, Task<T>& task)
+{
+    job_system.wait(task.launch(job_system));
+    if constexpr(std::is_void<T>::value) return;
+    else return std::move(task.result());
+}
+
+#endif // MJOB_CORO_HPP
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <iostream>
+
+/**
+ * One line of output, the values streamed into it are separated by spaces
+ */
+class LogLine
+{
+public:
+    ~LogLine()
+    {
+        std::cout << std::endl;
+    }
+
+    template<typename T>
+    LogLine& operator<<(const T& value)
+    {
+        std::cout << value << ' ';
+        return *this;
+    }
+};
+
+inline LogLine log_info()
+{
+    return LogLine();
+}
+
+/**
+ * Number of failed checks so far, main returns non zero if there are any. Timings are only ever logged
+ */
+inline int& failed_checks()
+{
+    static int failed = 0;
+    return failed;
+}
+
+/**
+ * @brief check Log and count the failure when condition is false
+ * NOTE: Not threadsafe, only call from the thread running the tests
+ * @param condition
+ * @param what Description of what should hold
+ * @return condition
+ */
+inline bool check(bool condition, const char* what)
+{
+    if(!condition)
+    {
+        failed_checks()++;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+    return condition;
+}
+
+#endif // LOG_H
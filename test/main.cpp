@@ -1,12 +1,17 @@
-#include <QCoreApplication>
-#include <QDebug>
-
 #include <unistd.h> //For usleep
+#include <fcntl.h> //For open
 
+#include "log.h"
 #include "timing.h"
 #include "mjob.hpp"
 #include "vector.h"
+#include "physics_world.h"
 #include <functional>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
 
 int fib(int n)
 {
@@ -22,7 +27,7 @@ int fib(int n)
   return b;
 }
 
-void empty_job(const void* p)
+void empty_job(const void*)
 {
   //  fib(100000);
 }
@@ -37,10 +42,9 @@ extern __inline unsigned long long
 
 void fib_test()
 {
+    //The constructor returns once every worker is up and running
     JobSystem job_system;
 
-    usleep(20000); //Sleep 10 ms for thread to come up and running
-
     //Benchmark one single run
     const int num_jobs = 4096;
     const int loops = 1;
@@ -53,7 +57,7 @@ void fib_test()
     }
     stopwatch.Stop();
     double single_thread_1_run = (stopwatch.ElapsedNanoseconds() / double(num_jobs)) / 1e6;
-    qDebug() << "Actual job takes " << single_thread_1_run << " milliseconds ";
+    log_info() << "Actual job takes " << single_thread_1_run << " milliseconds ";
 
     //Benchmark job system runs
     for(std::size_t k=0; k < 1; k++)
@@ -78,38 +82,1280 @@ void fib_test()
     double ms_per_job = stopwatch.ElapsedMilliseconds() / loops / num_jobs;
     std::size_t cycles_per_job = (r2 - r1) / loops / num_jobs;
 
-    qInfo() << "Time: " << stopwatch.ElapsedMilliseconds() << "ms | per run:" <<
+    log_info() << "Time: " << stopwatch.ElapsedMilliseconds() << "ms | per run:" <<
         ms_per_job << "ms | calculated overhead: " << (ms_per_job - single_thread_1_run);
-    qInfo() << "Total Cycles: " << (r2 - r1) << " | per job: " << cycles_per_job;
+    log_info() << "Total Cycles: " << (r2 - r1) << " | per job: " << cycles_per_job;
 
 
     }
 }
 
-#include <QApplication>
-#include "simple_physics_demo.h"
+std::atomic<uint32_t> stage_counter;
+std::atomic<uint32_t> stage_errors;
+
+void stage_a_job(const void*)
+{
+    //Stage A may run in any order with its siblings, but always before stage B
+    if(stage_counter++ >= 64) stage_errors++;
+}
+
+void stage_b_job(const void*)
+{
+    if(stage_counter++ != 64) stage_errors++;
+}
 
-int simple_physics_demo(int argc, char* argv[])
+void stage_c_job(const void*)
 {
-    QApplication app(argc, argv);
+    if(stage_counter++ != 65) stage_errors++;
+}
 
-    SimplePhysicsDemo* spd = new SimplePhysicsDemo(50);
-    spd->showNormal();
+void continuation_test()
+{
+    JobSystem job_system;
 
-    return app.exec();
+    const int loops = 100;
+    stage_errors = 0;
+    for(int n=0; n < loops; n++)
+    {
+        stage_counter = 0;
+        //A (64 jobs) -> B -> C, submitted once and waited on at the end of the chain
+        Job* stage_a = job_system.create_job(empty_job);
+        for(int i=0; i < 64; i++)
+        {
+            job_system.enqueue(job_system.create_job_as_child(stage_a, stage_a_job));
+        }
+        Job* stage_b = job_system.create_job(stage_b_job);
+        Job* stage_c = job_system.create_job(stage_c_job);
+        job_system.add_continuation(stage_a, stage_b);
+        job_system.add_continuation(stage_b, stage_c);
+        job_system.enqueue(stage_a);
+        job_system.wait(stage_c);
+    }
+    log_info() << "Continuation chain: " << loops << " runs | errors: " << stage_errors.load();
+    check(stage_errors == 0, "continuations run in order");
 }
 
-int main(int argc, char *argv[])
+template<typename Allocate>
+std::size_t allocate_jobs(Allocate allocate, std::size_t num_jobs)
 {
-    //SimplePhysicsDemo spd;
-    //spd.run();
+    std::size_t r1 = rdtsc();
+    for(std::size_t i=0; i < num_jobs; i++)
+    {
+        Job* job = allocate();
+        job->pfn = empty_job;
+        job->parent = nullptr;
+        //Jobs are never enqueued here, leave the slot free so it can be reused
+        job->continuation_count.store(continuations_released, std::memory_order_relaxed);
+        job->unfinished_jobs.store(0, std::memory_order_relaxed);
+    }
+    std::size_t r2 = rdtsc();
+    return (r2 - r1) / num_jobs;
+}
 
-    //simple_physics_demo(argc, argv);
+void allocator_test()
+{
+    const std::size_t num_jobs = 1 << 20;
+    const std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
 
-    fib_test();
-    //std::function<void()> fn = []() {};
-    //qDebug() << sizeof(fn);
+    for(std::size_t num_threads=1; num_threads <= max_threads; num_threads *= 2)
+    {
+        std::vector<std::unique_ptr<JobAllocator>> allocators(num_threads);
+        std::vector<std::size_t> local_cycles(num_threads);
+        std::vector<std::thread> threads;
+        for(std::size_t t=0; t < num_threads; t++)
+        {
+            allocators[t] = std::make_unique<JobAllocator>();
+        }
+
+        for(std::size_t t=0; t < num_threads; t++)
+        {
+            threads.emplace_back([&, t]() {
+                local_cycles[t] = allocate_jobs([&]() { return allocators[t]->allocate(); }, num_jobs);
+            });
+        }
+        for(std::thread& thread : threads) thread.join();
+
+        //The shared counter allocator this replaced is compared in the allocator benchmark
+        std::size_t local_max = *std::max_element(local_cycles.begin(), local_cycles.end());
+        log_info() << "Create cost with " << num_threads << " threads | per worker allocator: " << local_max << " cycles per job";
+    }
+
+    //A finished job somebody still waits on must not be handed out again before the waiter left
+    std::unique_ptr<JobAllocator> allocator = std::make_unique<JobAllocator>();
+    Job* waited = allocator->allocate();
+    waited->waiters.fetch_add(1);
+    bool reused = false;
+    for(uint32_t i=0; i < JobAllocator::capacity; i++) reused |= allocator->allocate() == waited;
+    check(!reused, "slots with waiters are skipped");
+    waited->waiters.fetch_sub(1);
+    for(uint32_t i=0; i < JobAllocator::capacity; i++) reused |= allocator->allocate() == waited;
+    check(reused, "slots are reused once the waiters left");
+}
+
+std::atomic<uint32_t> produced_jobs_executed;
+
+void produced_job(const void*)
+{
+    produced_jobs_executed++;
+}
+
+void producer_test()
+{
+    JobSystem job_system(4);
+
+    //Network and IO style threads that are not workers submit jobs concurrently
+    const int num_producers = 16;
+    const int batches = 200;
+    const int jobs_per_batch = 64;
+    produced_jobs_executed = 0;
+
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    std::vector<std::thread> producers;
+    for(int p=0; p < num_producers; p++)
+    {
+        producers.emplace_back([&]() {
+            for(int b=0; b < batches; b++)
+            {
+                Job* root = job_system.create_job(empty_job);
+                for(int i=0; i < jobs_per_batch; i++)
+                {
+                    job_system.enqueue(job_system.create_job_as_child(root, produced_job));
+                }
+                job_system.enqueue(root);
+                job_system.wait(root);
+            }
+        });
+    }
+    for(std::thread& producer : producers) producer.join();
+    stopwatch.Stop();
+
+    const uint32_t expected = num_producers * batches * jobs_per_batch;
+    log_info() << "Producers: " << num_producers << " | executed " << produced_jobs_executed.load() << " of " << expected <<
+        " jobs in " << stopwatch.ElapsedMilliseconds() << "ms";
+    check(produced_jobs_executed == expected, "every job from external producers runs");
+}
+
+const int fan_out = 4;
+
+void fan_out_job(JobSystem* job_system, Job* root, int depth)
+{
+    if(depth == 0) return;
+    for(int i=0; i < fan_out; i++)
+    {
+        //Spawned from inside a job, so the children land on this worker's own queue
+        job_system->enqueue(job_system->create_job_as_child(root, [=]() { fan_out_job(job_system, root, depth - 1); }));
+    }
+}
+
+void fan_out_test()
+{
+    //fan_out^depth leaf jobs, with every level spawned from the worker that ran its parent
+    const int depth = 5;
+    const int loops = 100;
+    std::size_t num_jobs = 0;
+    for(int d=0, n=1; d <= depth; d++, n *= fan_out) num_jobs += n;
+
+    for(std::size_t num_workers=1; num_workers <= std::max(4u, std::thread::hardware_concurrency()); num_workers *= 2)
+    {
+        JobSystem job_system(num_workers);
+
+        Stopwatch stopwatch;
+        stopwatch.Start();
+        std::size_t r1 = rdtsc();
+        for(int n=0; n < loops; n++)
+        {
+            Job* root = job_system.create_job(empty_job);
+            job_system.enqueue(job_system.create_job_as_child(root, [&job_system, root]() {
+                fan_out_job(&job_system, root, depth);
+            }));
+            job_system.enqueue(root);
+            job_system.wait(root);
+        }
+        std::size_t r2 = rdtsc();
+        stopwatch.Stop();
+
+        log_info() << "Nested fan out with " << num_workers << " workers | " <<
+            (num_jobs * loops) / (stopwatch.ElapsedMilliseconds() / 1000.0) << " jobs per second | " <<
+            (r2 - r1) / (num_jobs * loops) << " cycles per job";
+    }
+}
+
+std::atomic<long> woken_at_ns;
+
+long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void wake_job(const void*)
+{
+    woken_at_ns = now_ns();
+}
+
+double process_cpu_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void idle_policy_test(const char* name, const IdlePolicy& policy)
+{
+    const std::size_t num_workers = std::max(2u, std::thread::hardware_concurrency());
+    JobSystem job_system(num_workers, policy);
+
+    //CPU burnt by the workers while there is nothing to do
+    const int idle_ms = 200;
+    usleep(20000);
+    double cpu1 = process_cpu_ms();
+    usleep(idle_ms * 1000);
+    double cpu2 = process_cpu_ms();
+    double idle_cpu = (cpu2 - cpu1) / idle_ms / (num_workers - 1) * 100.0;
+
+    //Time from enqueue until an idle worker runs the job, the calling thread does not help
+    const int samples = 50;
+    std::vector<long> latencies;
+    for(int i=0; i < samples; i++)
+    {
+        usleep(5000);
+        woken_at_ns = 0;
+        Job* job = job_system.create_job(wake_job);
+        long enqueued_at_ns = now_ns();
+        job_system.enqueue(job);
+        while(woken_at_ns == 0) cpu_relax();
+        latencies.push_back(woken_at_ns - enqueued_at_ns);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    log_info() << "Idle policy" << name << "with" << num_workers << "workers | idle cpu per worker:" << idle_cpu <<
+        "% | wake up latency median:" << latencies[samples / 2] / 1e3 << "us max:" << latencies.back() / 1e3 << "us";
+}
+
+void idle_test()
+{
+    IdlePolicy spin;
+    spin.park = false;
+    idle_policy_test("spin/yield", spin);
+    idle_policy_test("spin/yield/park", IdlePolicy());
+}
+
+void parallel_for_test()
+{
+    const std::size_t count = 1 << 22;
+    std::vector<float> in(count);
+    std::vector<float> serial_out(count);
+    std::vector<float> parallel_out(count);
+    for(std::size_t i=0; i < count; i++) in[i] = float(i);
+
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    for(std::size_t i=0; i < count; i++) serial_out[i] = std::sqrt(in[i]) * 0.5f + 1.0f;
+    stopwatch.Stop();
+    double serial_ms = stopwatch.ElapsedMilliseconds();
+
+    for(std::size_t num_workers=1; num_workers <= std::max(4u, std::thread::hardware_concurrency()); num_workers *= 2)
+    {
+        JobSystem job_system(num_workers);
+        stopwatch.Start();
+        job_system.parallel_for(0, count, 4096, [&](std::size_t i) {
+            parallel_out[i] = std::sqrt(in[i]) * 0.5f + 1.0f;
+        });
+        stopwatch.Stop();
+        log_info() << "parallel_for over" << count << "floats with" << num_workers << "workers |" <<
+            stopwatch.ElapsedMilliseconds() << "ms vs serial" << serial_ms << "ms | matches serial:" <<
+            (parallel_out == serial_out);
+        check(parallel_out == serial_out, "parallel_for matches the serial loop");
+        std::fill(parallel_out.begin(), parallel_out.end(), 0.0f);
+    }
+}
+
+struct LargeCapture
+{
+    float values[64];
+};
+
+//Small enough for the payload but aligned stricter than it, like a captured AVX vector
+struct alignas(32) AlignedCapture
+{
+    uintptr_t* address;
+    float value;
+};
+
+struct alignas(64) OverAlignedCapture
+{
+    uintptr_t* address;
+    float values[20];
+};
+
+void lambda_test()
+{
+    JobSystem job_system(4);
+
+    //Small captures live in the job payload, large ones in the allocator's payload arena
+    const int num_jobs = 4096;
+    std::vector<int> small_out(num_jobs);
+    std::vector<float> large_out(num_jobs);
+    LargeCapture large;
+    for(int i=0; i < 64; i++) large.values[i] = float(i);
+
+    std::size_t r1 = rdtsc();
+    Job* root = job_system.create_job(empty_job);
+    for(int i=0; i < num_jobs - 1; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(root, [&small_out, i]() { small_out[i] = i; }));
+    }
+    job_system.enqueue(root);
+    job_system.wait(root);
+    std::size_t r2 = rdtsc();
+
+    root = job_system.create_job(empty_job);
+    for(int i=0; i < num_jobs - 1; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(root, [&large_out, large, i]() {
+            large_out[i] = large.values[i % 64];
+        }));
+    }
+    job_system.enqueue(root);
+    job_system.wait(root);
+    std::size_t r3 = rdtsc();
+
+    //Over aligned captures must be constructed at an aligned address wherever they are stored.
+    //The addresses are checked afterwards, inside the job the compiler may assume they are aligned
+    const int num_aligned = 64;
+    std::vector<uintptr_t> aligned_addresses(num_aligned);
+    std::vector<uintptr_t> over_aligned_addresses(num_aligned);
+    root = job_system.create_job(empty_job);
+    for(int i=0; i < num_aligned; i++)
+    {
+        AlignedCapture aligned{&aligned_addresses[i], float(i)};
+        job_system.enqueue(job_system.create_job_as_child(root, [aligned]() {
+            *aligned.address = reinterpret_cast<uintptr_t>(&aligned);
+        }));
+        OverAlignedCapture over_aligned{&over_aligned_addresses[i], {}};
+        job_system.enqueue(job_system.create_job_as_child(root, [over_aligned]() {
+            *over_aligned.address = reinterpret_cast<uintptr_t>(&over_aligned);
+        }));
+    }
+    job_system.enqueue(root);
+    job_system.wait(root);
+
+    int errors = 0;
+    for(int i=0; i < num_aligned; i++)
+    {
+        if(aligned_addresses[i] % alignof(AlignedCapture) != 0) errors++;
+        if(over_aligned_addresses[i] % alignof(OverAlignedCapture) != 0) errors++;
+    }
+    for(int i=0; i < num_jobs - 1; i++)
+    {
+        if(small_out[i] != i || large_out[i] != float(i % 64)) errors++;
+    }
+    log_info() << "Lambda jobs | small capture:" << (r2 - r1) / num_jobs << "cycles per job | large capture:" <<
+        (r3 - r2) / num_jobs << "cycles per job | errors:" << errors;
+    check(errors == 0, "lambda jobs run with their captures, aligned as declared");
+}
+
+void queue_test()
+{
+    //Owner pushes and pops while thieves steal, every job must come out exactly once.
+    //Starts small so the deque grows several times under contention
+    const int num_jobs = 1 << 20;
+    const int num_thieves = 3;
+    std::unique_ptr<Job[]> jobs(new Job[num_jobs]);
+    std::unique_ptr<std::atomic<uint32_t>[]> taken(new std::atomic<uint32_t>[num_jobs]);
+    for(int i=0; i < num_jobs; i++) taken[i] = 0;
+
+    WorkStealingQueue<64> queue;
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> stolen{0};
+    std::vector<std::thread> thieves;
+    for(int t=0; t < num_thieves; t++)
+    {
+        thieves.emplace_back([&]() {
+            while(!done)
+            {
+                if(Job* job = queue.steal())
+                {
+                    taken[job - jobs.get()]++;
+                    stolen++;
+                }
+            }
+        });
+    }
+    for(int i=0; i < num_jobs; i++)
+    {
+        queue.push(&jobs[i]);
+        //Pop every third push so the bottom moves both ways
+        if(i % 3 == 0)
+        {
+            if(Job* job = queue.pop()) taken[job - jobs.get()]++;
+        }
+    }
+    while(Job* job = queue.pop()) taken[job - jobs.get()]++;
+    done = true;
+    for(std::thread& thief : thieves) thief.join();
+
+    int errors = 0;
+    for(int i=0; i < num_jobs; i++)
+    {
+        if(taken[i] != 1) errors++;
+    }
+
+    //Uncontended throughput of the owner's end
+    WorkStealingQueue<> owner_queue;
+    std::size_t r1 = rdtsc();
+    for(int n=0; n < 256; n++)
+    {
+        for(int i=0; i < 4096; i++) owner_queue.push(&jobs[i]);
+        for(int i=0; i < 4096; i++) owner_queue.pop();
+    }
+    std::size_t r2 = rdtsc();
+    for(int i=0; i < 4096; i++) owner_queue.push(&jobs[i]);
+    std::size_t r3 = rdtsc();
+    for(int i=0; i < 4096; i++) owner_queue.steal();
+    std::size_t r4 = rdtsc();
+
+    log_info() << "WorkStealingQueue | " << num_jobs << " jobs, " << stolen.load() << " stolen, capacity grew to " <<
+        queue.capacity() << " | errors: " << errors;
+    check(errors == 0, "every job pushed onto the deque comes out exactly once");
+    log_info() << "WorkStealingQueue | push+pop: " << (r2 - r1) / (256 * 4096) << " cycles | steal: " <<
+        (r4 - r3) / 4096 << " cycles";
+}
+
+void steal_test()
+{
+    //One owner keeps its deque topped up while every other thread does nothing but steal,
+    //the worst case for the deque's top and bottom indices sharing a cache line
+    static Job jobs[256];
+    const int duration_ms = 100;
+    const std::size_t max_threads = std::max(32u, std::thread::hardware_concurrency());
+
+    for(std::size_t num_threads=8; num_threads <= max_threads; num_threads *= 2)
+    {
+        WorkStealingQueue<> queue;
+        std::atomic<bool> done{false};
+        std::atomic<std::size_t> total_steals{0};
+        std::size_t owner_ops = 0;
+        std::vector<std::thread> thieves;
+        for(std::size_t t=1; t < num_threads; t++)
+        {
+            thieves.emplace_back([&]() {
+                std::size_t steals = 0;
+                while(!done)
+                {
+                    if(queue.steal()) steals++;
+                }
+                total_steals += steals;
+            });
+        }
+
+        Stopwatch stopwatch;
+        stopwatch.Start();
+        do
+        {
+            for(int i=0; i < 64; i++)
+            {
+                if(queue.size() < 256) queue.push(&jobs[i]);
+                if(i % 4 == 0) queue.pop();
+                owner_ops++;
+            }
+            stopwatch.Stop();
+        } while(stopwatch.ElapsedMilliseconds() < duration_ms);
+        done = true;
+        for(std::thread& thief : thieves) thief.join();
+
+        log_info() << "Steal heavy with" << num_threads << "threads |" <<
+            total_steals.load() / (stopwatch.ElapsedMilliseconds() / 1000.0) << "steals per second |" <<
+            owner_ops / (stopwatch.ElapsedMilliseconds() / 1000.0) << "owner operations per second";
+    }
+}
+
+void imbalanced_policy_test(const char* name, const StealPolicy& policy)
+{
+    const std::size_t num_workers = std::max(4u, std::thread::hardware_concurrency());
+    JobSystem job_system(num_workers, IdlePolicy(), policy);
+
+    //Every job starts out on worker 0 and one in sixteen is 32 times as expensive as the rest
+    const int num_jobs = 4096;
+    const int loops = 10;
+    std::atomic<uint32_t> sink{0};
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    for(int n=0; n < loops; n++)
+    {
+        Job* root = job_system.create_job(empty_job);
+        for(int i=0; i < num_jobs - 1; i++)
+        {
+            const int work = i % 16 == 0 ? 32 * 256 : 256;
+            job_system.enqueue(job_system.create_job_as_child(root, [work, &sink]() {
+                sink += fib(work);
+            }));
+        }
+        job_system.enqueue(root);
+        job_system.wait(root);
+    }
+    stopwatch.Stop();
+
+    log_info() << "Imbalanced work with" << num_workers << "workers, steal policy" << name << "|" <<
+        stopwatch.ElapsedMilliseconds() / loops << "ms per run";
+}
+
+void imbalanced_test()
+{
+    StealPolicy single;
+    single.attempts = 1;
+    single.steal_half = false;
+    imbalanced_policy_test("1 attempt", single);
+
+    StealPolicy random;
+    random.steal_half = false;
+    imbalanced_policy_test("8 attempts", random);
+
+    imbalanced_policy_test("8 attempts + steal half", StealPolicy());
+}
+
+void spin_for_us(long us)
+{
+    const long until = now_ns() + us * 1000;
+    while(now_ns() < until) cpu_relax();
+}
+
+void wait_mode_test(const char* name, WaitMode mode)
+{
+    JobSystem job_system(4);
+
+    //The awaited job is stolen by another worker while the waiting thread's own queue is full of
+    //unrelated 50us jobs. Measures how late wait returns after the awaited job completed
+    const int samples = 50;
+    std::vector<long> latencies;
+    for(int n=0; n < samples; n++)
+    {
+        std::atomic<long> completed_at_ns{0};
+        Job* awaited = job_system.create_job([&completed_at_ns]() {
+            spin_for_us(200);
+            completed_at_ns = now_ns();
+        });
+        job_system.enqueue(awaited);
+        Job* background = job_system.create_job(empty_job);
+        for(int i=0; i < 64; i++)
+        {
+            job_system.enqueue(job_system.create_job_as_child(background, []() { spin_for_us(50); }));
+        }
+        job_system.enqueue(background);
+
+        job_system.wait(awaited, mode);
+        latencies.push_back(now_ns() - completed_at_ns);
+        job_system.wait(background);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    log_info() << "Wait mode" << name << "| return latency median:" << latencies[samples / 2] / 1e3 <<
+        "us p90:" << latencies[samples * 9 / 10] / 1e3 << "us max:" << latencies.back() / 1e3 << "us";
+}
+
+void wait_test()
+{
+    wait_mode_test("help_any", WaitMode::help_any);
+    wait_mode_test("help_related", WaitMode::help_related);
+    wait_mode_test("park", WaitMode::park);
+
+    //wait_all and wait_any from a thread that is not a worker
+    JobSystem job_system(4);
+    std::size_t first = 0;
+    std::thread external([&]() {
+        Job* slow = job_system.create_job([]() { spin_for_us(5000); });
+        Job* fast = job_system.create_job([]() { spin_for_us(100); });
+        job_system.enqueue(slow);
+        job_system.enqueue(fast);
+        first = job_system.wait_any({slow, fast});
+        job_system.wait_all({slow, fast});
+    });
+    external.join();
+    log_info() << "wait_any from an external thread returned job" << first << "of 2";
+    check(first < 2, "wait_any returns the index of a job");
+}
 
+void priority_test()
+{
+    const std::size_t num_workers = std::max(4u, std::thread::hardware_concurrency());
+    JobSystem job_system(num_workers);
+
+    //Saturate every worker with low priority background work
+    Job* background = job_system.create_job(empty_job);
+    for(std::size_t i=0; i < 5000 * num_workers; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(background, []() { spin_for_us(20); }), JobPriority::low);
+    }
+    job_system.enqueue(background, JobPriority::low);
+
+    //Meanwhile another thread submits probe jobs and measures how long they take to start
+    std::vector<long> latencies[num_priorities];
+    std::thread prober([&]() {
+        for(int n=0; !job_system.has_job_completed(background); n++)
+        {
+            //Low priority probes queue up with the background, like every job did before priorities
+            const JobPriority priority = n % 2 == 0 ? JobPriority::high : JobPriority::low;
+            std::atomic<long> started_at_ns{0};
+            Job* probe = job_system.create_job([&started_at_ns]() { started_at_ns = now_ns(); });
+            const long enqueued_at_ns = now_ns();
+            job_system.enqueue(probe, priority);
+            job_system.wait(probe);
+            if(job_system.has_job_completed(background)) break;
+            latencies[static_cast<std::size_t>(priority)].push_back(started_at_ns - enqueued_at_ns);
+            usleep(500);
+        }
+    });
+    job_system.wait(background);
+    prober.join();
+
+    const char* names[] = { "high", "normal", "low" };
+    for(std::size_t p=0; p < num_priorities; p++)
+    {
+        std::vector<long>& samples = latencies[p];
+        if(samples.empty()) continue;
+        std::sort(samples.begin(), samples.end());
+        log_info() << "Priority" << names[p] << "under saturating low priority load |" << samples.size() <<
+            "samples | start latency median:" << samples[samples.size() / 2] / 1e3 << "us p99:" <<
+            samples[samples.size() * 99 / 100] / 1e3 << "us";
+    }
+}
+
+void graph_test()
+{
+    //1000 nodes in 10 layers of 100, every node depends on two nodes of the layer before
+    const uint32_t layers = 10;
+    const uint32_t width = 100;
+    const uint32_t num_nodes = layers * width;
+    const int frames = 200;
+    std::unique_ptr<std::atomic<int>[]> done(new std::atomic<int>[num_nodes]);
+    std::atomic<uint32_t> errors{0};
+    int frame = 0;
+    for(uint32_t i=0; i < num_nodes; i++) done[i] = -1;
+
+    auto node_work = [&](uint32_t node) {
+        //Both dependencies must already have run this frame
+        if(node >= width)
+        {
+            const uint32_t layer_start = (node / width - 1) * width;
+            if(done[layer_start + node % width] != frame) errors++;
+            if(done[layer_start + (node + 1) % width] != frame) errors++;
+        }
+        done[node] = frame;
+    };
+
+    JobSystem job_system(4);
+    JobGraph graph(job_system);
+    for(uint32_t node=0; node < num_nodes; node++)
+    {
+        graph.add_node([&node_work, node]() { node_work(node); });
+    }
+    for(uint32_t node=width; node < num_nodes; node++)
+    {
+        const uint32_t layer_start = (node / width - 1) * width;
+        graph.add_edge(layer_start + node % width, node);
+        graph.add_edge(layer_start + (node + 1) % width, node);
+    }
+    const bool compiled = graph.compile();
+
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    for(frame=0; frame < frames; frame++)
+    {
+        graph.run();
+    }
+    stopwatch.Stop();
+    const double graph_ms = stopwatch.ElapsedMilliseconds() / frames;
+
+    //The same frame built by hand every time, with a wait between layers
+    stopwatch.Start();
+    for(frame=frames; frame < 2 * frames; frame++)
+    {
+        for(uint32_t layer=0; layer < layers; layer++)
+        {
+            Job* root = job_system.create_job(empty_job);
+            for(uint32_t node=layer * width; node < (layer + 1) * width; node++)
+            {
+                job_system.enqueue(job_system.create_job_as_child(root, [&node_work, node]() { node_work(node); }));
+            }
+            job_system.enqueue(root);
+            job_system.wait(root);
+        }
+    }
+    stopwatch.Stop();
+    const double manual_ms = stopwatch.ElapsedMilliseconds() / frames;
+
+    log_info() << "JobGraph with" << num_nodes << "nodes | compiled:" << compiled << "| graph:" << graph_ms <<
+        "ms per frame | manual resubmission:" << manual_ms << "ms per frame | errors:" << errors.load();
+    check(compiled, "the layered graph compiles");
+    check(errors == 0, "graph nodes run after their dependencies");
+}
+
+void stats_test()
+{
+    const std::size_t num_workers = 4;
+    JobSystem job_system(num_workers);
+
+    //Every job is spawned from the thread that created the system, so the other workers have to steal
+    const uint32_t num_jobs = 100000;
+    Job* root = job_system.create_job(empty_job);
+    for(uint32_t i=0; i < num_jobs; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(root, []() { spin_for_us(1); }));
+    }
+    job_system.enqueue(root);
+    job_system.wait(root);
+
+    const JobSystemStats stats = job_system.stats();
+    for(std::size_t i=0; i < stats.workers.size(); i++)
+    {
+        const WorkerStats& worker = stats.workers[i];
+        log_info() << "Worker" << i << "| executed:" << worker.executed << "stolen:" << worker.stolen << "failed steals:" <<
+            worker.failed_steals << "queue high water:" << worker.queue_high_water << "| busy:" << worker.busy_ns / 1e6 <<
+            "ms idle:" << worker.idle_ns / 1e6 << "ms";
+    }
+    //The root job plus it's children
+    log_info() << "Stats | executed" << stats.total.executed << "of" << num_jobs + 1 << "jobs | stolen:" << stats.total.stolen;
+    check(!stats_enabled || stats.total.executed == num_jobs + 1, "stats count every executed job");
+}
+
+void trace_test()
+{
+    if(!trace_enabled)
+    {
+        log_info() << "Tracing compiled out, build with MJOB_TRACE=1 to record jobs";
+        return;
+    }
+    JobSystem job_system(4);
+    job_system.set_tracing(true);
+    Job* root = job_system.create_job(empty_job);
+    for(int i=0; i < 1000; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(root, []() { spin_for_us(5); }));
+    }
+    job_system.enqueue(root);
+    job_system.wait(root);
+    job_system.set_tracing(false);
+
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "mjob_trace.json";
+    {
+        std::ofstream out(path);
+        job_system.write_chrome_trace(out);
+    }
+    std::ifstream in(path);
+    const std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::size_t events = 0;
+    for(std::size_t pos=trace.find("\"ph\":\"X\""); pos != std::string::npos; pos=trace.find("\"ph\":\"X\"", pos + 1)) events++;
+    log_info() << "Trace | recorded" << events << "of 1001 jobs to" << path.string().c_str();
+    check(events == 1001, "the trace holds every job");
+}
+
+/**
+ * Steps the physics world in parallel and checks the grid found exactly the overlaps a brute force all pairs test finds
+ */
+void physics_test()
+{
+    const std::size_t ball_count = 5000;
+    JobSystem job_system(4);
+    PhysicsWorld world(1400.0f, 1400.0f, ball_count);
+    std::size_t mismatches = 0;
+    std::size_t collisions = 0;
+    for(int frame=0; frame < 10; frame++)
+    {
+        const std::vector<float> x(world.x(), world.x() + ball_count);
+        const std::vector<float> y(world.y(), world.y() + ball_count);
+        world.step(&job_system);
+        for(std::size_t i=0; i < ball_count; i++)
+        {
+            bool hit = false;
+            for(std::size_t j=0; j < ball_count && !hit; j++)
+            {
+                const float dx = x[i] - x[j];
+                const float dy = y[i] - y[j];
+                const float reach = world.radius()[i] + world.radius()[j];
+                hit = i != j && dx * dx + dy * dy < reach * reach;
+            }
+            if(hit != bool(world.colliding()[i])) mismatches++;
+            collisions += hit;
+        }
+    }
+    log_info() << "Physics | colliding balls" << collisions << "mismatches" << mismatches;
+    check(mismatches == 0, "the grid finds the same overlaps as testing all pairs");
+}
+
+/**
+ * Runs the batch kernels over ranges that do not split into whole batches and compares them with the scalar vectors
+ */
+void simd_test()
+{
+    const std::size_t count = 1003;
+    JobSystem job_system(4);
+    std::vector<float> x(count), y(count), z(count), length(count), dot(count);
+    for(std::size_t i=0; i < count; i++)
+    {
+        x[i] = float(std::rand() % 2001 - 1000) / 10.0f;
+        y[i] = float(std::rand() % 2001 - 1000) / 10.0f;
+        z[i] = float(std::rand() % 2001 - 1000) / 10.0f;
+    }
+    x[7] = y[7] = z[7] = 0.0f;
+    const std::vector<float> ox = x, oy = y, oz = z;
+
+    job_system.parallel_range(std::size_t(0), count, 100, [&](std::size_t begin, std::size_t end)
+    {
+        batch_length(x.data(), y.data(), z.data(), length.data(), begin, end);
+        batch_normalize(x.data(), y.data(), z.data(), begin, end);
+        batch_dot(x.data(), y.data(), z.data(), ox.data(), oy.data(), oz.data(), dot.data(), begin, end);
+    });
+
+    float max_error = 0.0f;
+    for(std::size_t i=0; i < count; i++)
+    {
+        v3 v(ox[i], oy[i], oz[i]);
+        const v3 n = v.unit_vector();
+        max_error = std::max(max_error, std::fabs(length[i] - v.length()) / std::max(1.0f, v.length()));
+        max_error = std::max(max_error, std::fabs(x[i] - n.x));
+        max_error = std::max(max_error, std::fabs(y[i] - n.y));
+        max_error = std::max(max_error, std::fabs(z[i] - n.z));
+        //n dot v is the length again
+        max_error = std::max(max_error, std::fabs(dot[i] - v.length()) / std::max(1.0f, v.length()));
+    }
+    log_info() << "SIMD | backend" << simd_backend << "max error" << max_error;
+    check(max_error < 1e-4f, "batch kernels match the scalar vectors");
+}
+
+/**
+ * Same fan out as fib_test, submitted with create_children and enqueue_batch, then with per child lambdas
+ * submitted from inside a job so the batch goes onto a worker's deque
+ */
+void batch_test()
+{
+    JobSystem job_system;
+    const std::size_t num_jobs = 4096;
+    std::vector<Job*> children(num_jobs - 1);
+
+    //Only the submission is timed, once with a loop like fib_test and once as a batch
+    Job* root = job_system.create_job(empty_job);
+    std::size_t r1 = rdtsc();
+    for(std::size_t i=0; i < num_jobs - 1; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(root, empty_job));
+    }
+    std::size_t r2 = rdtsc();
+    job_system.enqueue(root);
+    job_system.wait(root);
+    const std::size_t loop_cycles = (r2 - r1) / (num_jobs - 1);
+
+    root = job_system.create_job(empty_job);
+    r1 = rdtsc();
+    job_system.create_children(root, children.size(), empty_job, children.data());
+    job_system.enqueue_batch(children.data(), children.size());
+    r2 = rdtsc();
+    job_system.enqueue(root);
+    job_system.wait(root);
+    log_info() << "Batch | submit cycles per job, loop:" << loop_cycles << "batch:" << (r2 - r1) / (num_jobs - 1);
+
+    //The batch and the job creating it share an allocator, leave room for the jobs in flight
+    children.resize(num_jobs / 2);
+    std::vector<std::atomic<uint32_t>> ran(children.size());
+    for(std::atomic<uint32_t>& count : ran) count = 0;
+    root = job_system.create_job(empty_job);
+    job_system.enqueue(job_system.create_job_as_child(root, [&]()
+    {
+        job_system.create_children(root, children.size(), [&ran](std::size_t i) { ran[i]++; }, children.data());
+        job_system.enqueue_batch(children.data(), children.size());
+    }));
+    job_system.enqueue(root);
+    job_system.wait(root);
+    std::size_t wrong = 0;
+    for(std::atomic<uint32_t>& count : ran) wrong += count != 1;
+    log_info() << "Batch | children that did not run exactly once: " << wrong;
+    check(wrong == 0, "every batched child runs exactly once");
+}
+
+/**
+ * Jobs sleeping on the blocking pool next to compute jobs, the compute jobs should finish long before the sleepers
+ * and the sleepers should overlap rather than take turns on the two workers
+ */
+void blocking_test()
+{
+    JobSystem job_system(2);
+    const int blocking_jobs = 8;
+    const int compute_jobs = 2000;
+    std::atomic<int> continuations{0};
+
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    Job* blocking_root = job_system.create_job(empty_job);
+    for(int i=0; i < blocking_jobs; i++)
+    {
+        Job* job = job_system.create_job_as_child(blocking_root, []() { usleep(50000); });
+        job_system.add_continuation(job, job_system.create_job_as_child(blocking_root, [&continuations]() { continuations++; }));
+        job_system.enqueue_blocking(job);
+    }
+    Job* compute_root = job_system.create_job(empty_job);
+    for(int i=0; i < compute_jobs; i++)
+    {
+        job_system.enqueue(job_system.create_job_as_child(compute_root, []() { spin_for_us(10); }));
+    }
+    job_system.enqueue(compute_root);
+    job_system.wait(compute_root);
+    stopwatch.Stop();
+    const double compute_ms = stopwatch.ElapsedMilliseconds();
+    job_system.enqueue(blocking_root);
+    job_system.wait(blocking_root);
+    stopwatch.Stop();
+    const JobSystemStats stats = job_system.stats();
+    log_info() << "Blocking | compute done after" << compute_ms << "ms, everything after" << stopwatch.ElapsedMilliseconds()
+               << "ms | continuations:" << continuations.load() << "of" << blocking_jobs
+               << "| pool ran" << stats.blocking_executed << "jobs on at most" << stats.blocking_peak_threads << "threads";
+    check(continuations == blocking_jobs, "every blocking job's continuation runs");
+}
+
+/**
+ * Writes a file with submit_write and reads it back with submit_read, checking every chunk in a continuation of it's read.
+ * Once through io_uring and once through the blocking pool
+ */
+void io_test()
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "mjob_io_test.bin";
+    const std::size_t chunk_size = 64 * 1024;
+    const std::size_t chunks = 37;
+    std::vector<unsigned char> data(chunk_size * chunks);
+    for(std::size_t i=0; i < data.size(); i++) data[i] = static_cast<unsigned char>(i * 131u + (i >> 12));
+
+    for(bool io_uring : {true, false})
+    {
+        IoPolicy io_policy;
+        io_policy.use_io_uring = io_uring;
+        JobSystem job_system(4, IdlePolicy(), StealPolicy(), AffinityPolicy(), BlockingPolicy(), io_policy);
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        std::vector<IoRequest> requests(chunks);
+
+        Job* root = job_system.create_job(empty_job);
+        for(std::size_t c=0; c < chunks; c++)
+        {
+            requests[c].fd = fd;
+            requests[c].buffer = data.data() + c * chunk_size;
+            requests[c].size = chunk_size;
+            requests[c].offset = c * chunk_size;
+            job_system.submit_write(root, &requests[c]);
+        }
+        job_system.enqueue(root);
+        job_system.wait(root);
+        std::size_t written = 0;
+        for(const IoRequest& request : requests) written += request.result == int64_t(chunk_size);
+
+        std::vector<unsigned char> read_back(data.size());
+        std::atomic<std::size_t> verified{0};
+        root = job_system.create_job(empty_job);
+        for(std::size_t c=0; c < chunks; c++)
+        {
+            Job* read = job_system.create_job_as_child(root, empty_job);
+            job_system.add_continuation(read, job_system.create_job_as_child(root, [&, c]()
+            {
+                const std::size_t offset = c * chunk_size;
+                if(requests[c].result == int64_t(chunk_size) &&
+                   std::memcmp(read_back.data() + offset, data.data() + offset, chunk_size) == 0) verified++;
+            }));
+            requests[c].buffer = read_back.data() + c * chunk_size;
+            job_system.submit_read(read, &requests[c]);
+            job_system.enqueue(read);
+        }
+        job_system.enqueue(root);
+        job_system.wait(root);
+        ::close(fd);
+
+        //A failing transfer still completes, with the error as it's result
+        IoRequest bad_request;
+        bad_request.fd = -1;
+        bad_request.buffer = read_back.data();
+        bad_request.size = chunk_size;
+        bad_request.offset = 0;
+        root = job_system.create_job(empty_job);
+        job_system.submit_read(root, &bad_request);
+        job_system.enqueue(root);
+        job_system.wait(root);
+
+        log_info() << "IO |" << (job_system.uses_io_uring() ? "io_uring" : "blocking pool") << "| chunks written:" << written
+                   << "verified:" << verified.load() << "of" << chunks << "| read from a bad fd:" << bad_request.result;
+        check(written == chunks && verified == chunks, "every chunk is written and read back intact");
+        check(bad_request.result == -EBADF, "a failed transfer completes with it's error");
+    }
+    std::filesystem::remove(path);
+}
+
+/**
+ * Jobs enqueued with enqueue_after across every level of the timing wheel, none may run early and idle workers
+ * should run them well within 100us of their deadline. Also a tick that schedules the next one from inside itself
+ */
+void timer_test()
+{
+    JobSystem job_system(2);
+    using clock = std::chrono::steady_clock;
+    const std::chrono::microseconds delays[] = {
+        std::chrono::microseconds(0), std::chrono::microseconds(40), std::chrono::microseconds(700),
+        std::chrono::microseconds(2500), std::chrono::microseconds(16000), std::chrono::microseconds(90000),
+        std::chrono::microseconds(300000)};
+    const int per_delay = 8;
+    std::vector<int64_t> lateness_ns(std::size(delays) * per_delay);
+
+    Job* root = job_system.create_job(empty_job);
+    for(std::size_t d=0; d < std::size(delays); d++)
+    {
+        for(int i=0; i < per_delay; i++)
+        {
+            //Spread the deadlines so they land in different slots
+            const clock::time_point deadline = clock::now() + delays[d] + std::chrono::microseconds(i * 37);
+            int64_t* lateness = &lateness_ns[d * per_delay + i];
+            job_system.enqueue_at(job_system.create_job_as_child(root, [deadline, lateness]()
+            {
+                *lateness = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - deadline).count();
+            }), deadline);
+        }
+    }
+
+    //Sixty ticks per second, each one enqueues the next
+    const int ticks = 10;
+    std::atomic<int> ticked{0};
+    std::function<void()> tick = [&]()
+    {
+        if(++ticked < ticks) job_system.enqueue_after(job_system.create_job_as_child(root, tick), std::chrono::microseconds(16667));
+    };
+    job_system.enqueue_after(job_system.create_job_as_child(root, tick), std::chrono::microseconds(16667));
+
+    job_system.enqueue(root);
+    job_system.wait(root);
+
+    int early = 0;
+    int64_t total_ns = 0;
+    for(int64_t ns : lateness_ns)
+    {
+        early += ns < 0;
+        total_ns += ns;
+    }
+    std::sort(lateness_ns.begin(), lateness_ns.end());
+    const int64_t median_ns = lateness_ns[lateness_ns.size() / 2];
+    const int64_t p90_ns = lateness_ns[lateness_ns.size() * 9 / 10];
+    log_info() << "Timer | timers:" << lateness_ns.size() << "early:" << early << "| lateness mean"
+               << double(total_ns) / lateness_ns.size() / 1000.0 << "us median" << median_ns / 1000.0 << "us p90" << p90_ns / 1000.0
+               << "us max" << lateness_ns.back() / 1000.0 << "us | ticks:" << ticked.load() << "of" << ticks
+               << "| still pending:" << job_system.pending_timers();
+    check(early == 0, "no timer fires before its deadline");
+    check(ticked == ticks && job_system.pending_timers() == 0, "every timer fires");
+    //An idle worker is up before every deadline and services the wheel from there, so a timer is late by the tick it
+    //was rounded up to plus one pass of get_job. Only a worker the OS took the cpu from misses that, the median does not
+    check(median_ns < 100000, "the median timer fires within 100us of it's deadline");
+}
+
+void write_file(const std::filesystem::path& path, const std::string& text)
+{
+    std::ofstream(path) << text;
+}
+
+void topology_test()
+{
+    //Two packages with two hyper threaded cores each, numbered like Linux does with the siblings last
+    const std::filesystem::path root = std::filesystem::temp_directory_path() / "mjob_fake_sysfs";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    write_file(root / "online", "0-7\n");
+    for(uint32_t cpu=0; cpu < 8; cpu++)
+    {
+        const uint32_t package = (cpu / 2) % 2;
+        const std::filesystem::path dir = root / ("cpu" + std::to_string(cpu));
+        std::filesystem::create_directories(dir / "topology");
+        std::filesystem::create_directories(dir / ("node" + std::to_string(package)));
+        write_file(dir / "topology" / "core_id", std::to_string(cpu % 2));
+        write_file(dir / "topology" / "physical_package_id", std::to_string(package));
+    }
+
+    CpuTopology topology;
+    const bool loaded = topology.load(root.string());
+    const std::vector<CpuTopology::Cpu> placement = topology.placement();
+    //Every core gets a worker before any core gets a second one, and each half stays node by node
+    bool placement_ok = placement.size() == 8;
+    for(std::size_t i=0; placement_ok && i < placement.size(); i++)
+    {
+        for(std::size_t j=0; j < i; j++)
+        {
+            if(i < 4 && placement[j].core == placement[i].core) placement_ok = false;
+        }
+        if(placement[i].node != (i % 4) / 2) placement_ok = false;
+    }
+
+    //Pinning also applies to the thread creating the job system, until the job system is destroyed
+    std::atomic<uint32_t> executed{0};
+    const CpuTopology::Affinity affinity_before = CpuTopology::get_current_affinity();
+    {
+        AffinityPolicy affinity;
+        affinity.pin_threads = true;
+        affinity.sysfs_root = root.string();
+        JobSystem job_system(4, IdlePolicy(), StealPolicy(), affinity);
+        Job* parent = job_system.create_job(empty_job);
+        for(int i=0; i < 1000; i++)
+        {
+            job_system.enqueue(job_system.create_job_as_child(parent, [&executed]() { executed++; }));
+        }
+        job_system.enqueue(parent);
+        job_system.wait(parent);
+    }
+    const CpuTopology::Affinity affinity_after = CpuTopology::get_current_affinity();
+    check(affinity_before.valid && affinity_after.valid && CPU_EQUAL(&affinity_before.set, &affinity_after.set),
+          "the creating thread gets it's affinity back");
+    std::filesystem::remove_all(root);
+
+    //Malformed cpu lists and node links must make load fail or be skipped, never throw
+    bool malformed_ok = true;
+    const std::filesystem::path odd_root = std::filesystem::temp_directory_path() / "mjob_odd_sysfs";
+    std::filesystem::remove_all(odd_root);
+    std::filesystem::create_directories(odd_root / "cpu0" / "topology");
+    std::filesystem::create_directories(odd_root / "cpu0" / "node99999999999");
+    std::filesystem::create_directories(odd_root / "cpu0" / "node");
+    write_file(odd_root / "cpu0" / "topology" / "core_id", "0");
+    write_file(odd_root / "cpu0" / "topology" / "physical_package_id", "0");
+    for(const char* online : {"\n", ",\n", "x-1\n", "0-\n", "3-1\n", "99999999999999999999\n"})
+    {
+        write_file(odd_root / "online", online);
+        CpuTopology odd;
+        if(odd.load(odd_root.string())) malformed_ok = false;
+    }
+    write_file(odd_root / "online", "0\n");
+    CpuTopology odd_nodes;
+    if(!odd_nodes.load(odd_root.string()) || odd_nodes.cpus()[0].node != 0) malformed_ok = false;
+    std::filesystem::remove_all(odd_root);
+
+    CpuTopology machine;
+    machine.load(AffinityPolicy().sysfs_root);
+    log_info() << "Topology | fake sysfs loaded:" << loaded << "with" << topology.cpus().size() << "cpus | placement ok:" <<
+        placement_ok << "| malformed sysfs handled:" << malformed_ok << "| pinned job system executed" << executed.load() << "of 1000 jobs | this machine has" <<
+        machine.cpus().size() << "cpus";
+    check(loaded && placement_ok, "the fake topology loads and places one worker per core first");
+    check(malformed_ok, "malformed sysfs contents fail to load instead of throwing");
+    check(executed == 1000, "a pinned job system runs every job");
+}
+
+#ifdef __cpp_impl_coroutine
+#include "mjob_coro.hpp"
+
+Task<void> await_jobs(JobSystem& job_system, std::size_t iterations)
+{
+    for(std::size_t i=0; i < iterations; i++)
+    {
+        Job* job = job_system.create_job(empty_job);
+        job_system.enqueue(job);
+        co_await job;
+    }
+}
+
+Task<void> await_job(JobSystem&, Job* job, std::atomic<bool>& resumed)
+{
+    co_await job;
+    resumed.store(true);
+}
+
+//Splits like a recursive job tree, one half is launched so other workers can steal it
+Task<long> sum_task(JobSystem& job_system, long begin, long end)
+{
+    if(end - begin <= 1024)
+    {
+        long sum = 0;
+        for(long i=begin; i < end; i++) sum += i;
+        co_return sum;
+    }
+    const long middle = begin + (end - begin) / 2;
+    Task<long> left = sum_task(job_system, begin, middle);
+    Job* left_job = left.launch(job_system);
+    const long right = co_await sum_task(job_system, middle, end);
+    co_await left_job;
+    co_return left.result() + right;
+}
+
+void coroutine_test()
+{
+    const std::size_t iterations = 100000;
+    JobSystem job_system(4);
+
+    //A worker blocking in wait() until the job it enqueued completed
+    Job* blocking_root = job_system.create_job([&job_system, iterations]() {
+        for(std::size_t i=0; i < iterations; i++)
+        {
+            Job* job = job_system.create_job(empty_job);
+            job_system.enqueue(job);
+            job_system.wait(job);
+        }
+    });
+    Stopwatch stopwatch;
+    stopwatch.Start();
+    job_system.enqueue(blocking_root);
+    job_system.wait(blocking_root);
+    stopwatch.Stop();
+    const double wait_ns = double(stopwatch.ElapsedNanoseconds()) / iterations;
+
+    //The same loop suspending instead, the worker is free to run other jobs meanwhile
+    Task<void> loop = await_jobs(job_system, iterations);
+    stopwatch.Start();
+    sync_wait(job_system, loop);
+    stopwatch.Stop();
+    const double await_ns = double(stopwatch.ElapsedNanoseconds()) / iterations;
+
+    const long count = 1 << 22;
+    Task<long> sum = sum_task(job_system, 0, count);
+    const long total = sync_wait(job_system, sum);
+
+    log_info() << "Coroutines | co_await job:" << await_ns << "ns per job | wait():" << wait_ns <<
+        "ns per job | task tree sum correct:" << (total == count * (count - 1) / 2);
+    check(total == count * (count - 1) / 2, "the coroutine task tree sums correctly");
+
+    //Every continuation slot of the awaited job is taken, the coroutine retries instead of blocking it's worker
+    std::atomic<bool> resumed{false};
+    Job* full = job_system.create_job(empty_job);
+    for(uint32_t i=0; i < max_continuations; i++) job_system.add_continuation(full, job_system.create_job(empty_job));
+    Task<void> full_waiter = await_job(job_system, full, resumed);
+    Job* full_waiter_job = full_waiter.launch(job_system);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const bool resumed_early = resumed.load();
+    job_system.enqueue(full);
+    job_system.wait(full_waiter_job);
+    check(!resumed_early && resumed.load(), "awaiting a job without free continuation slots resumes once it completed");
+
+    //Frames created after a job system is gone must not come from it's destroyed workers
+    {
+        JobSystem scoped(2);
+    }
+    check(JobWorker::current() == nullptr, "destroying a job system unbinds it's worker");
+    check(job_system.get_current_worker() != nullptr, "the outer job system still finds it's worker");
+}
+#endif
+
+int main()
+{
+    fib_test();
+    continuation_test();
+    allocator_test();
+    producer_test();
+    fan_out_test();
+    idle_test();
+    parallel_for_test();
+    lambda_test();
+    queue_test();
+    steal_test();
+    imbalanced_test();
+    wait_test();
+    priority_test();
+    graph_test();
+#ifdef __cpp_impl_coroutine
+    coroutine_test();
+#endif
+    topology_test();
+    stats_test();
+    trace_test();
+    physics_test();
+    simd_test();
+    batch_test();
+    blocking_test();
+    io_test();
+    timer_test();
 
-    return 0;
+    //A hang is caught by the test's timeout
+    log_info() << "Failed checks:" << failed_checks();
+    return failed_checks() == 0 ? 0 : 1;
 }
@@ -0,0 +1,22 @@
+#include <QApplication>
+#include "simple_physics_demo.h"
+
+#include <cctype>
+#include <cstdlib>
+
+/**
+ * physics_demo [balls]
+ * The same simulation runs without Qt in mjob_physics_headless
+ */
+int main(int argc, char* argv[])
+{
+    std::size_t ball_count = 2000;
+    if(argc > 1 && std::isdigit(static_cast<unsigned char>(argv[1][0]))) ball_count = std::strtoul(argv[1], nullptr, 10);
+
+    QApplication app(argc, argv);
+
+    SimplePhysicsDemo* spd = new SimplePhysicsDemo(ball_count);
+    spd->showNormal();
+
+    return app.exec();
+}
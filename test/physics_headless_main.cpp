@@ -0,0 +1,39 @@
+#include "mjob.hpp"
+#include "test/physics_world.h"
+#include "test/timing.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+/**
+ * mjob_physics_headless [balls] [frames]
+ * Runs the physics demo's simulation without a window or Qt, timing the serial and the parallel step
+ */
+int main(int argc, char* argv[])
+{
+    std::size_t ball_count = 2000;
+    std::size_t frames = 100;
+    if(argc > 1 && std::isdigit(static_cast<unsigned char>(argv[1][0]))) ball_count = std::strtoul(argv[1], nullptr, 10);
+    if(argc > 2 && std::isdigit(static_cast<unsigned char>(argv[2][0]))) frames = std::max<std::size_t>(1u, std::strtoul(argv[2], nullptr, 10));
+
+    //Keep the density of the window, about one ball per 20x20 pixels
+    const float side = std::max(100.0f, std::sqrt(float(ball_count)) * 20.0f);
+    JobSystem job_system;
+    PhysicsWorld serial_world(side, side, ball_count);
+    PhysicsWorld parallel_world(side, side, ball_count);
+    Stopwatch sw;
+    sw.Start();
+    for(std::size_t f=0; f < frames; f++) serial_world.step(nullptr);
+    sw.Stop();
+    const double serial_ms = sw.ElapsedMilliseconds() / frames;
+    sw.Start();
+    for(std::size_t f=0; f < frames; f++) parallel_world.step(&job_system);
+    sw.Stop();
+    const double parallel_ms = sw.ElapsedMilliseconds() / frames;
+    std::printf("%zu balls, %zu frames, serial %.3fms, parallel %.3fms per frame\n",
+                ball_count, frames, serial_ms, parallel_ms);
+    return 0;
+}
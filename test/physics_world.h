@@ -0,0 +1,287 @@
+#ifndef PHYSICS_WORLD_H
+#define PHYSICS_WORLD_H
+
+#include "mjob.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+/**
+ * Balls bouncing off each other and the walls of a box, without any dependency on Qt so it can run headless.
+ * Ball data is kept as separate float arrays. Every step builds a uniform grid in parallel, tests each ball
+ * against the balls in the 3x3 cells around it and then moves the balls. A ball only ever writes it's own
+ * entries, so any range of balls can be handled by any job.
+ * Passing nullptr as the job system runs a step serially on the calling thread
+ */
+class PhysicsWorld
+{
+public:
+    static constexpr float min_radius = 2.5f;
+    static constexpr float max_radius = 12.5f;
+
+    PhysicsWorld(float width, float height, std::size_t ball_count, uint32_t seed = 1) :
+        m_width(width),
+        m_height(height),
+        m_px(ball_count),
+        m_py(ball_count),
+        m_vx(ball_count),
+        m_vy(ball_count),
+        m_radius(ball_count),
+        m_colliding(ball_count),
+        m_ball_cell(ball_count),
+        m_cell_balls(ball_count)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> radius(min_radius, max_radius);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> speed(1.0f, 5.0f);
+        for(std::size_t i=0; i < ball_count; i++)
+        {
+            const float r = radius(random);
+            m_radius[i] = r;
+            m_px[i] = r + unit(random) * (width - 2.0f * r);
+            m_py[i] = r + unit(random) * (height - 2.0f * r);
+            m_vx[i] = speed(random);
+            m_vy[i] = speed(random);
+            m_colliding[i] = 0;
+        }
+
+        //Balls never overlap more than one neighbouring cell in each direction
+        m_cell_size = 2.0f * max_radius;
+        m_columns = std::max(1u, static_cast<uint32_t>(std::ceil(width / m_cell_size)));
+        m_rows = std::max(1u, static_cast<uint32_t>(std::ceil(height / m_cell_size)));
+        const std::size_t cell_count = std::size_t(m_columns) * m_rows;
+        m_cell_counts.reset(new std::atomic<uint32_t>[cell_count]);
+        m_cell_cursors.reset(new std::atomic<uint32_t>[cell_count]);
+        m_cell_start.resize(cell_count + 1u);
+        m_block_sums.resize((cell_count + scan_block - 1u) / scan_block + 1u);
+    }
+
+    /**
+     * @brief step Advance the simulation by one frame
+     * @param job_system nullptr to run serially
+     */
+    void step(JobSystem* job_system)
+    {
+        build_grid(job_system);
+        for_range(job_system, 0, size(), collision_grain, [this](std::size_t begin, std::size_t end)
+        {
+            collide(begin, end);
+        });
+        for_range(job_system, 0, size(), move_grain, [this](std::size_t begin, std::size_t end)
+        {
+            move(begin, end);
+        });
+    }
+
+    std::size_t size() const { return m_px.size(); }
+    float width() const { return m_width; }
+    float height() const { return m_height; }
+    const float* x() const { return m_px.data(); }
+    const float* y() const { return m_py.data(); }
+    const float* radius() const { return m_radius.data(); }
+    //Whether the ball touched another ball during the last step
+    const uint8_t* colliding() const { return m_colliding.data(); }
+
+private:
+    static constexpr std::size_t collision_grain = 512u;
+    static constexpr std::size_t move_grain = 4096u;
+    static constexpr std::size_t grid_grain = 4096u;
+    //Cells summed by one job of the prefix sum
+    static constexpr std::size_t scan_block = 16384u;
+
+    template<typename Function>
+    static void for_range(JobSystem* job_system, std::size_t begin, std::size_t end, std::size_t grain, Function&& fn)
+    {
+        if(job_system) job_system->parallel_range(begin, end, grain, fn);
+        else fn(begin, end);
+    }
+
+    uint32_t cell_of(float x, float y) const
+    {
+        const uint32_t column = std::min(m_columns - 1u, static_cast<uint32_t>(std::max(0.0f, x) / m_cell_size));
+        const uint32_t row = std::min(m_rows - 1u, static_cast<uint32_t>(std::max(0.0f, y) / m_cell_size));
+        return row * m_columns + column;
+    }
+
+    /**
+     * @brief build_grid Counting sort of the balls by cell, every phase runs in parallel.
+     * Afterwards the balls in cell c are m_cell_balls[m_cell_start[c]] up to m_cell_start[c + 1]
+     * @param job_system
+     */
+    void build_grid(JobSystem* job_system)
+    {
+        const std::size_t cell_count = m_cell_start.size() - 1u;
+        for_range(job_system, 0, cell_count, grid_grain, [this](std::size_t begin, std::size_t end)
+        {
+            for(std::size_t c=begin; c < end; c++) m_cell_counts[c].store(0, std::memory_order_relaxed);
+        });
+        for_range(job_system, 0, size(), grid_grain, [this](std::size_t begin, std::size_t end)
+        {
+            for(std::size_t i=begin; i < end; i++)
+            {
+                const uint32_t cell = cell_of(m_px[i], m_py[i]);
+                m_ball_cell[i] = cell;
+                m_cell_counts[cell].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        //Prefix sum in blocks, sum every block in parallel, scan the block sums and then the blocks themselves
+        const std::size_t block_count = (cell_count + scan_block - 1u) / scan_block;
+        for_range(job_system, 0, block_count, 1, [this, cell_count](std::size_t begin, std::size_t end)
+        {
+            for(std::size_t b=begin; b < end; b++)
+            {
+                uint32_t sum = 0;
+                for(std::size_t c=b * scan_block; c < std::min(cell_count, (b + 1u) * scan_block); c++)
+                {
+                    sum += m_cell_counts[c].load(std::memory_order_relaxed);
+                }
+                m_block_sums[b] = sum;
+            }
+        });
+        uint32_t offset = 0;
+        for(std::size_t b=0; b < block_count; b++)
+        {
+            const uint32_t sum = m_block_sums[b];
+            m_block_sums[b] = offset;
+            offset += sum;
+        }
+        m_cell_start[cell_count] = offset;
+        for_range(job_system, 0, block_count, 1, [this, cell_count](std::size_t begin, std::size_t end)
+        {
+            for(std::size_t b=begin; b < end; b++)
+            {
+                uint32_t start = m_block_sums[b];
+                for(std::size_t c=b * scan_block; c < std::min(cell_count, (b + 1u) * scan_block); c++)
+                {
+                    m_cell_start[c] = start;
+                    m_cell_cursors[c].store(start, std::memory_order_relaxed);
+                    start += m_cell_counts[c].load(std::memory_order_relaxed);
+                }
+            }
+        });
+
+        for_range(job_system, 0, size(), grid_grain, [this](std::size_t begin, std::size_t end)
+        {
+            for(std::size_t i=begin; i < end; i++)
+            {
+                const uint32_t slot = m_cell_cursors[m_ball_cell[i]].fetch_add(1, std::memory_order_relaxed);
+                m_cell_balls[slot] = static_cast<uint32_t>(i);
+            }
+        });
+    }
+
+    /**
+     * @brief collide Test the balls in grid order [begin, end) against their neighbours and bounce them off,
+     * only writes those balls. Going through the balls cell by cell keeps the neighbours of the last few balls in cache
+     * @param begin
+     * @param end
+     */
+    void collide(std::size_t begin, std::size_t end)
+    {
+        for(std::size_t sorted=begin; sorted < end; sorted++)
+        {
+            const uint32_t i = m_cell_balls[sorted];
+            const float px = m_px[i];
+            const float py = m_py[i];
+            const float r = m_radius[i];
+            const uint32_t cell = m_ball_cell[i];
+            const uint32_t column = cell % m_columns;
+            const uint32_t row = cell / m_columns;
+
+            //Sum of the directions away from every ball we overlap
+            float nx = 0.0f;
+            float ny = 0.0f;
+            bool hit = false;
+            for(uint32_t y=row > 0 ? row - 1u : 0; y <= std::min(row + 1u, m_rows - 1u); y++)
+            {
+                for(uint32_t x=column > 0 ? column - 1u : 0; x <= std::min(column + 1u, m_columns - 1u); x++)
+                {
+                    const uint32_t neighbour_cell = y * m_columns + x;
+                    for(uint32_t k=m_cell_start[neighbour_cell]; k < m_cell_start[neighbour_cell + 1u]; k++)
+                    {
+                        const uint32_t j = m_cell_balls[k];
+                        if(j == i) continue;
+                        const float dx = px - m_px[j];
+                        const float dy = py - m_py[j];
+                        const float reach = r + m_radius[j];
+                        if(dx * dx + dy * dy < reach * reach)
+                        {
+                            nx += dx;
+                            ny += dy;
+                            hit = true;
+                        }
+                    }
+                }
+            }
+
+            m_colliding[i] = hit;
+            //Reflect the velocity off the contact normal, unless already moving away
+            const float vn = m_vx[i] * nx + m_vy[i] * ny;
+            const float nn = nx * nx + ny * ny;
+            if(hit && vn < 0.0f && nn > 0.0f)
+            {
+                m_vx[i] -= 2.0f * vn / nn * nx;
+                m_vy[i] -= 2.0f * vn / nn * ny;
+            }
+        }
+    }
+
+    void move(std::size_t begin, std::size_t end)
+    {
+        for(std::size_t i=begin; i < end; i++)
+        {
+            const float r = m_radius[i];
+            float px = m_px[i] + m_vx[i];
+            float py = m_py[i] + m_vy[i];
+            if(px < r)
+            {
+                px = r;
+                m_vx[i] = std::fabs(m_vx[i]);
+            }
+            else if(px > m_width - r)
+            {
+                px = m_width - r;
+                m_vx[i] = -std::fabs(m_vx[i]);
+            }
+            if(py < r)
+            {
+                py = r;
+                m_vy[i] = std::fabs(m_vy[i]);
+            }
+            else if(py > m_height - r)
+            {
+                py = m_height - r;
+                m_vy[i] = -std::fabs(m_vy[i]);
+            }
+            m_px[i] = px;
+            m_py[i] = py;
+        }
+    }
+
+    float m_width;
+    float m_height;
+    std::vector<float> m_px;
+    std::vector<float> m_py;
+    std::vector<float> m_vx;
+    std::vector<float> m_vy;
+    std::vector<float> m_radius;
+    std::vector<uint8_t> m_colliding;
+
+    //Uniform grid rebuilt every step
+    float m_cell_size;
+    uint32_t m_columns;
+    uint32_t m_rows;
+    std::vector<uint32_t> m_ball_cell;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_cell_counts;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_cell_cursors;
+    std::vector<uint32_t> m_cell_start;
+    std::vector<uint32_t> m_cell_balls;
+    std::vector<uint32_t> m_block_sums;
+};
+
+#endif // PHYSICS_WORLD_H
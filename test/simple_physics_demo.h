@@ -4,17 +4,13 @@
 #include <QWidget>
 
 #include "mjob.hpp"
-#include "test/vector.h"
+#include "test/physics_world.h"
 
 class SimplePhysicsDemo : public QWidget
 {
     Q_OBJECT
 public:
-    SimplePhysicsDemo(std::size_t ball_count);
-
-    void init_balls();
-    void check_collisions(std::size_t off, std::size_t count);
-    void update_position(std::size_t off, std::size_t count);
+    SimplePhysicsDemo(std::size_t ball_count, int width = 1280, int height = 720);
 
     void timerEvent(QTimerEvent* qte);
     void paintEvent(QPaintEvent* qpe);
@@ -22,11 +18,11 @@ public:
 private:
     bool m_running = true;
     JobSystem m_job_system;
-    std::vector<v2> m_ball_p;
-    std::vector<v2> m_ball_v;
-    std::vector<int> m_ball_s;
-    std::vector<QColor> m_ball_c;
-    double m_simulation_time;
+    PhysicsWorld m_world;
+    double m_simulation_time = 0.0;
+    double m_serial_time = 0.0;
+    double m_parallel_time = 0.0;
+    std::size_t m_frame = 0;
 };
 
 
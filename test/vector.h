@@ -2,8 +2,22 @@
 #define VECTOR_H
 
 #include <cmath>
+#include <cstddef>
 #include <type_traits>
 
+//Backend of the batch types, picked from the target flags. Define VECTOR_FORCE_SCALAR for plain scalar code
+#if !defined(VECTOR_FORCE_SCALAR) && defined(__AVX512F__) && defined(__AVX512VL__) && (defined(__FMA__) || defined(_MSC_VER))
+#define VECTOR_SIMD_AVX512 1
+#elif !defined(VECTOR_FORCE_SCALAR) && defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define VECTOR_SIMD_AVX2 1
+#elif !defined(VECTOR_FORCE_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define VECTOR_SIMD_SSE 1
+#endif
+
+#if defined(VECTOR_SIMD_AVX512) || defined(VECTOR_SIMD_AVX2) || defined(VECTOR_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
 template<typename T>
 struct _v2
 {
@@ -46,12 +60,12 @@ struct _v2
                static_cast<length_type>(y) * static_cast<length_type>(v.y);
     }
 
-    _v2<T> lerp(const _v2<T>& other, float lf)
+    _v2<T> lerp(const _v2<T>& other, float lf) const
     {
         //Lerp = a + (b - a) * lf;
-        T x = x + (other.x - x) * lf;
-        T y = y + (other.y - y) * lf;
-        return _v2<T>(x, y);
+        T _x = x + (other.x - x) * lf;
+        T _y = y + (other.y - y) * lf;
+        return _v2<T>(_x, _y);
     }
 
     _v2<T>& operator-=(const _v2<T>& rhs)
@@ -170,7 +184,7 @@ struct _v3
         return _v3<T>(x / l, y / l, z / l);
     }
 
-    _v3<T> lerp(const _v3<T>& other, float lf)
+    _v3<T> lerp(const _v3<T>& other, float lf) const
     {
         //Lerp = a + (b - a) * lf;
         T _x = x + (other.x - x) * lf;
@@ -271,7 +285,7 @@ struct _v4
         return sqrt(this->length_squared());
     }
 
-    float dot(const _v3<T>& other)
+    length_type dot(const _v4<T>& other) const
     {
         return static_cast<length_type>(x) * static_cast<length_type>(other.x) +
                static_cast<length_type>(y) * static_cast<length_type>(other.y) +
@@ -359,4 +373,328 @@ inline bool _v3<int>::operator==(const _v3<int>& other)
 }
 
 
+/*
+ * Batches of eight vectors stored as one register per component, for structure of array data.
+ * Backends are AVX-512 (with VL), AVX2 with FMA, SSE2 and plain scalar code. The AVX-512 backend keeps the batch
+ * at eight lanes of a 256 bit register, it uses masked loads and stores for the tail of an array and the more
+ * precise rsqrt14 rather than wider registers
+ */
+#if defined(VECTOR_SIMD_AVX512)
+constexpr const char* simd_backend = "avx512";
+#elif defined(VECTOR_SIMD_AVX2)
+constexpr const char* simd_backend = "avx2";
+#elif defined(VECTOR_SIMD_SSE)
+constexpr const char* simd_backend = "sse";
+#else
+constexpr const char* simd_backend = "scalar";
+#endif
+
+/**
+ * Eight floats
+ */
+struct f32x8
+{
+    static constexpr std::size_t lanes = 8;
+
+#if defined(VECTOR_SIMD_AVX512) || defined(VECTOR_SIMD_AVX2)
+    __m256 v;
+
+    static f32x8 broadcast(float value) { return {_mm256_set1_ps(value)}; }
+    static f32x8 load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+#elif defined(VECTOR_SIMD_SSE)
+    __m128 lo;
+    __m128 hi;
+
+    static f32x8 broadcast(float value) { return {_mm_set1_ps(value), _mm_set1_ps(value)}; }
+    static f32x8 load(const float* p) { return {_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}; }
+    void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+#else
+    float v[lanes];
+
+    static f32x8 broadcast(float value)
+    {
+        f32x8 result;
+        for(std::size_t i=0; i < lanes; i++) result.v[i] = value;
+        return result;
+    }
+    static f32x8 load(const float* p)
+    {
+        f32x8 result;
+        for(std::size_t i=0; i < lanes; i++) result.v[i] = p[i];
+        return result;
+    }
+    void store(float* p) const
+    {
+        for(std::size_t i=0; i < lanes; i++) p[i] = v[i];
+    }
+#endif
+
+    /**
+     * @brief load Loads count floats, the lanes past count are zero
+     * @param p
+     * @param count At most lanes
+     * @return
+     */
+    static f32x8 load(const float* p, std::size_t count)
+    {
+        if(count == lanes) return load(p);
+#if defined(VECTOR_SIMD_AVX512)
+        return {_mm256_maskz_loadu_ps(static_cast<__mmask8>((1u << count) - 1u), p)};
+#else
+        float lane[lanes] = {};
+        for(std::size_t i=0; i < count; i++) lane[i] = p[i];
+        return load(lane);
+#endif
+    }
+
+    /**
+     * @brief store Stores the first count lanes
+     * @param p
+     * @param count At most lanes
+     */
+    void store(float* p, std::size_t count) const
+    {
+        if(count == lanes) return store(p);
+#if defined(VECTOR_SIMD_AVX512)
+        _mm256_mask_storeu_ps(p, static_cast<__mmask8>((1u << count) - 1u), v);
+#else
+        float lane[lanes];
+        store(lane);
+        for(std::size_t i=0; i < count; i++) p[i] = lane[i];
+#endif
+    }
+};
+
+#if defined(VECTOR_SIMD_AVX512) || defined(VECTOR_SIMD_AVX2)
+inline f32x8 operator+(f32x8 a, f32x8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline f32x8 operator-(f32x8 a, f32x8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline f32x8 operator*(f32x8 a, f32x8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline f32x8 operator/(f32x8 a, f32x8 b) { return {_mm256_div_ps(a.v, b.v)}; }
+//a * b + c in one rounding
+inline f32x8 fmadd(f32x8 a, f32x8 b, f32x8 c) { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+inline f32x8 sqrt(f32x8 a) { return {_mm256_sqrt_ps(a.v)}; }
+//Lanes where lhs > rhs take a, the rest b
+inline f32x8 select_greater(f32x8 lhs, f32x8 rhs, f32x8 a, f32x8 b)
+{
+    return {_mm256_blendv_ps(b.v, a.v, _mm256_cmp_ps(lhs.v, rhs.v, _CMP_GT_OQ))};
+}
+#if defined(VECTOR_SIMD_AVX512)
+inline f32x8 rsqrt_estimate(f32x8 a) { return {_mm256_rsqrt14_ps(a.v)}; }
+#else
+inline f32x8 rsqrt_estimate(f32x8 a) { return {_mm256_rsqrt_ps(a.v)}; }
+#endif
+#elif defined(VECTOR_SIMD_SSE)
+inline f32x8 operator+(f32x8 a, f32x8 b) { return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)}; }
+inline f32x8 operator-(f32x8 a, f32x8 b) { return {_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)}; }
+inline f32x8 operator*(f32x8 a, f32x8 b) { return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)}; }
+inline f32x8 operator/(f32x8 a, f32x8 b) { return {_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)}; }
+inline f32x8 fmadd(f32x8 a, f32x8 b, f32x8 c) { return a * b + c; }
+inline f32x8 sqrt(f32x8 a) { return {_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)}; }
+inline f32x8 select_greater(f32x8 lhs, f32x8 rhs, f32x8 a, f32x8 b)
+{
+    //No blendv before SSE4.1
+    const __m128 lo = _mm_cmpgt_ps(lhs.lo, rhs.lo);
+    const __m128 hi = _mm_cmpgt_ps(lhs.hi, rhs.hi);
+    return {_mm_or_ps(_mm_and_ps(lo, a.lo), _mm_andnot_ps(lo, b.lo)),
+            _mm_or_ps(_mm_and_ps(hi, a.hi), _mm_andnot_ps(hi, b.hi))};
+}
+inline f32x8 rsqrt_estimate(f32x8 a) { return {_mm_rsqrt_ps(a.lo), _mm_rsqrt_ps(a.hi)}; }
+#else
+template<typename Function>
+inline f32x8 per_lane(Function fn)
+{
+    f32x8 result;
+    for(std::size_t i=0; i < f32x8::lanes; i++) result.v[i] = fn(i);
+    return result;
+}
+inline f32x8 operator+(f32x8 a, f32x8 b) { return per_lane([&](std::size_t i) { return a.v[i] + b.v[i]; }); }
+inline f32x8 operator-(f32x8 a, f32x8 b) { return per_lane([&](std::size_t i) { return a.v[i] - b.v[i]; }); }
+inline f32x8 operator*(f32x8 a, f32x8 b) { return per_lane([&](std::size_t i) { return a.v[i] * b.v[i]; }); }
+inline f32x8 operator/(f32x8 a, f32x8 b) { return per_lane([&](std::size_t i) { return a.v[i] / b.v[i]; }); }
+inline f32x8 fmadd(f32x8 a, f32x8 b, f32x8 c) { return a * b + c; }
+inline f32x8 sqrt(f32x8 a) { return per_lane([&](std::size_t i) { return std::sqrt(a.v[i]); }); }
+inline f32x8 select_greater(f32x8 lhs, f32x8 rhs, f32x8 a, f32x8 b)
+{
+    return per_lane([&](std::size_t i) { return lhs.v[i] > rhs.v[i] ? a.v[i] : b.v[i]; });
+}
+inline f32x8 rsqrt_estimate(f32x8 a) { return per_lane([&](std::size_t i) { return 1.0f / std::sqrt(a.v[i]); }); }
+#endif
+
+/**
+ * @brief rsqrt 1 / sqrt(a), the hardware estimate refined with one Newton-Raphson step
+ * @param a
+ * @return
+ */
+inline f32x8 rsqrt(f32x8 a)
+{
+#if defined(VECTOR_SIMD_AVX512) || defined(VECTOR_SIMD_AVX2) || defined(VECTOR_SIMD_SSE)
+    const f32x8 estimate = rsqrt_estimate(a);
+    //y * (1.5 - 0.5 * a * y * y)
+    const f32x8 half_a_y = a * estimate * f32x8::broadcast(0.5f);
+    return estimate * (f32x8::broadcast(1.5f) - half_a_y * estimate);
+#else
+    return rsqrt_estimate(a);
+#endif
+}
+
+inline f32x8& operator+=(f32x8& a, f32x8 b) { return a = a + b; }
+inline f32x8& operator-=(f32x8& a, f32x8 b) { return a = a - b; }
+inline f32x8& operator*=(f32x8& a, f32x8 b) { return a = a * b; }
+
+struct v2x8
+{
+    f32x8 x;
+    f32x8 y;
+
+    /**
+     * @brief load Vectors [i, i + count) of the component arrays
+     */
+    static v2x8 load(const float* xs, const float* ys, std::size_t i, std::size_t count = f32x8::lanes)
+    {
+        return {f32x8::load(xs + i, count), f32x8::load(ys + i, count)};
+    }
+
+    void store(float* xs, float* ys, std::size_t i, std::size_t count = f32x8::lanes) const
+    {
+        x.store(xs + i, count);
+        y.store(ys + i, count);
+    }
+
+    f32x8 dot(const v2x8& other) const { return fmadd(x, other.x, y * other.y); }
+    f32x8 length_squared() const { return dot(*this); }
+    f32x8 length() const { return sqrt(length_squared()); }
+
+    //Zero length vectors stay zero
+    v2x8 normalized() const
+    {
+        const f32x8 length_sq = length_squared();
+        const f32x8 zero = f32x8::broadcast(0.0f);
+        const f32x8 inverse = select_greater(length_sq, zero, rsqrt(length_sq), zero);
+        return {x * inverse, y * inverse};
+    }
+
+    v2x8 lerp(const v2x8& other, f32x8 lf) const
+    {
+        return {fmadd(other.x - x, lf, x), fmadd(other.y - y, lf, y)};
+    }
+
+    v2x8 operator+(const v2x8& rhs) const { return {x + rhs.x, y + rhs.y}; }
+    v2x8 operator-(const v2x8& rhs) const { return {x - rhs.x, y - rhs.y}; }
+    v2x8 operator*(f32x8 rhs) const { return {x * rhs, y * rhs}; }
+};
+
+struct v3x8
+{
+    f32x8 x;
+    f32x8 y;
+    f32x8 z;
+
+    static v3x8 load(const float* xs, const float* ys, const float* zs, std::size_t i, std::size_t count = f32x8::lanes)
+    {
+        return {f32x8::load(xs + i, count), f32x8::load(ys + i, count), f32x8::load(zs + i, count)};
+    }
+
+    void store(float* xs, float* ys, float* zs, std::size_t i, std::size_t count = f32x8::lanes) const
+    {
+        x.store(xs + i, count);
+        y.store(ys + i, count);
+        z.store(zs + i, count);
+    }
+
+    f32x8 dot(const v3x8& other) const { return fmadd(x, other.x, fmadd(y, other.y, z * other.z)); }
+    f32x8 length_squared() const { return dot(*this); }
+    f32x8 length() const { return sqrt(length_squared()); }
+
+    v3x8 normalized() const
+    {
+        const f32x8 length_sq = length_squared();
+        const f32x8 zero = f32x8::broadcast(0.0f);
+        const f32x8 inverse = select_greater(length_sq, zero, rsqrt(length_sq), zero);
+        return {x * inverse, y * inverse, z * inverse};
+    }
+
+    v3x8 lerp(const v3x8& other, f32x8 lf) const
+    {
+        return {fmadd(other.x - x, lf, x), fmadd(other.y - y, lf, y), fmadd(other.z - z, lf, z)};
+    }
+
+    v3x8 operator+(const v3x8& rhs) const { return {x + rhs.x, y + rhs.y, z + rhs.z}; }
+    v3x8 operator-(const v3x8& rhs) const { return {x - rhs.x, y - rhs.y, z - rhs.z}; }
+    v3x8 operator*(f32x8 rhs) const { return {x * rhs, y * rhs, z * rhs}; }
+};
+
+/*
+ * Kernels over structure of array data. Each handles [begin, end) so they can be used as the body of
+ * JobSystem::parallel_range, ranges that do not split evenly into batches end with one partial batch
+ */
+
+/**
+ * @brief for_each_batch Calls kernel(i, count) for every batch in [begin, end)
+ */
+template<typename Kernel>
+inline void for_each_batch(std::size_t begin, std::size_t end, Kernel&& kernel)
+{
+    std::size_t i = begin;
+    for(; i + f32x8::lanes <= end; i += f32x8::lanes) kernel(i, f32x8::lanes);
+    if(i < end) kernel(i, end - i);
+}
+
+inline void batch_length(const float* x, const float* y, float* out, std::size_t begin, std::size_t end)
+{
+    for_each_batch(begin, end, [=](std::size_t i, std::size_t count)
+    {
+        v2x8::load(x, y, i, count).length().store(out + i, count);
+    });
+}
+
+inline void batch_length(const float* x, const float* y, const float* z, float* out, std::size_t begin, std::size_t end)
+{
+    for_each_batch(begin, end, [=](std::size_t i, std::size_t count)
+    {
+        v3x8::load(x, y, z, i, count).length().store(out + i, count);
+    });
+}
+
+inline void batch_dot(const float* ax, const float* ay, const float* az,
+                      const float* bx, const float* by, const float* bz,
+                      float* out, std::size_t begin, std::size_t end)
+{
+    for_each_batch(begin, end, [=](std::size_t i, std::size_t count)
+    {
+        v3x8::load(ax, ay, az, i, count).dot(v3x8::load(bx, by, bz, i, count)).store(out + i, count);
+    });
+}
+
+//Normalizes in place, zero length vectors stay zero
+inline void batch_normalize(float* x, float* y, float* z, std::size_t begin, std::size_t end)
+{
+    for_each_batch(begin, end, [=](std::size_t i, std::size_t count)
+    {
+        v3x8::load(x, y, z, i, count).normalized().store(x, y, z, i, count);
+    });
+}
+
+/**
+ * @brief batch_integrate Fused semi-implicit Euler step, v += a * dt then p += v * dt, in one pass over the arrays
+ */
+inline void batch_integrate(float* px, float* py, float* vx, float* vy, v2 acceleration, float dt,
+                            std::size_t begin, std::size_t end)
+{
+    const f32x8 step = f32x8::broadcast(dt);
+    const f32x8 ax = f32x8::broadcast(acceleration.x * dt);
+    const f32x8 ay = f32x8::broadcast(acceleration.y * dt);
+    for_each_batch(begin, end, [=](std::size_t i, std::size_t count)
+    {
+        v2x8 v = v2x8::load(vx, vy, i, count);
+        v.x += ax;
+        v.y += ay;
+        v2x8 p = v2x8::load(px, py, i, count);
+        p.x = fmadd(v.x, step, p.x);
+        p.y = fmadd(v.y, step, p.y);
+        v.store(vx, vy, i, count);
+        p.store(px, py, i, count);
+    });
+}
+
 #endif // VECTOR_H